@@ -0,0 +1,496 @@
+#include "frozen_hash_map.h"
+#include "hash_map.h"
+#include "huge_page_allocator.h"
+#include "sharded_hash_map.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace bench_utils {
+class CacheMissCounter {
+public:
+    CacheMissCounter() {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~CacheMissCounter() {
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+
+    bool Available() const {
+        return fd_ != -1;
+    }
+
+    void Start() {
+        if (fd_ != -1) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t Stop() {
+        uint64_t count = 0;
+        if (fd_ != -1) {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd_, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+        return count;
+    }
+
+private:
+    long fd_ = -1;
+};
+
+template <class Function>
+void Measure(const std::string& name, size_t operations, Function function) {
+    CacheMissCounter counter;
+    auto start = std::chrono::steady_clock::now();
+    counter.Start();
+    function();
+    uint64_t misses = counter.Stop();
+    auto finish = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(finish - start).count();
+    std::cout << name << ": " << ns / operations << " ns/op";
+    if (counter.Available()) {
+        std::cout << ", " << static_cast<double>(misses) / operations << " cache misses/op";
+    }
+    std::cout << "\n";
+}
+
+std::vector<int> RandomKeys(size_t count, uint64_t seed) {
+    std::mt19937_64 rnd(seed);
+    std::vector<int> keys(count);
+    for (int& key : keys) {
+        key = static_cast<int>(rnd());
+    }
+    return keys;
+}
+
+// The storage scheme HashMap used before slots were grouped: separate pairs_ and used_ arrays,
+// probed one slot at a time with a double-hashing stride.
+class SplitLayoutTable {
+public:
+    explicit SplitLayoutTable(size_t capacity)
+        : pairs_(capacity), used_(capacity), capacity_(capacity) {
+    }
+
+    void Insert(int key, int value) {
+        size_t index = FindPosition(key);
+        pairs_[index] = {key, value};
+        used_[index] = 1;
+    }
+
+    bool Contains(int key) const {
+        return used_[FindPosition(key)] == 1;
+    }
+
+private:
+    constexpr static const size_t kShiftHashFactors[] = {239, 179, 191};
+    std::vector<std::pair<int, int>> pairs_;
+    std::vector<uint8_t> used_;
+    size_t capacity_;
+
+    size_t FindPosition(int key) const {
+        size_t hash = std::hash<int>()(key), shift_hash = 0;
+        for (size_t rate : kShiftHashFactors) {
+            shift_hash = (shift_hash * hash + rate) % capacity_;
+        }
+        shift_hash |= 1;
+        size_t index = hash % capacity_;
+        while (used_[index] == 1 && pairs_[index].first != key) {
+            index = (index + shift_hash) % capacity_;
+        }
+        return index;
+    }
+};
+}  // namespace bench_utils
+
+void BenchmarkLayout() {
+    const size_t count = 1 << 23;
+    std::vector<int> keys = bench_utils::RandomKeys(count, 1);
+    std::vector<int> lookups = keys;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937_64(2));
+
+    bench_utils::SplitLayoutTable split(count * 2);
+    HashMap<int, int> grouped;
+    for (int key : keys) {
+        split.Insert(key, key);
+        grouped[key] = key;
+    }
+
+    size_t found = 0;
+    bench_utils::Measure("split pairs_/used_ lookup", lookups.size(), [&] {
+        for (int key : lookups) {
+            found += split.Contains(key);
+        }
+    });
+    bench_utils::Measure("grouped lookup", lookups.size(), [&] {
+        for (int key : lookups) {
+            found += grouped.Find(key) != grouped.end();
+        }
+    });
+    std::cout << "found: " << found << "\n";
+}
+
+template <class Map>
+void MeasureRandomLookups(const std::string& name, Map& map, const std::vector<int>& keys) {
+    for (int key : keys) {
+        map[key] = key;
+    }
+    std::vector<int> lookups = keys;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937_64(2));
+    size_t found = 0;
+    bench_utils::Measure(name, lookups.size(), [&] {
+        for (int key : lookups) {
+            found += map.Find(key) != map.end();
+        }
+    });
+    std::cout << "found: " << found << "\n";
+}
+
+void BenchmarkHugePages() {
+    std::vector<int> keys = bench_utils::RandomKeys(1 << 23, 1);
+    {
+        HashMap<int, int> map;
+        MeasureRandomLookups("4 KB pages", map, keys);
+    }
+    {
+        HashMap<int, int, std::hash<int>, HugePageAllocator<std::pair<const int, int>>> map;
+        MeasureRandomLookups("huge pages", map, keys);
+    }
+}
+
+void BenchmarkSharded() {
+    const size_t keys = 1 << 20, operations = 1 << 18;
+    ShardedHashMap<int, int> map;
+    for (size_t key = 0; key < keys; ++key) {
+        map.Insert({static_cast<int>(key), 0});
+    }
+    for (size_t threads_count = 1; threads_count <= 64; threads_count *= 2) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t thread = 0; thread < threads_count; ++thread) {
+            threads.emplace_back([&map, thread] {
+                std::mt19937_64 rnd(thread);
+                for (size_t i = 0; i < operations; ++i) {
+                    int key = rnd() % keys;
+                    if (i % 10 == 0) {
+                        map.Upsert(key, [](int& value) { ++value; });
+                    } else {
+                        map.Contains(key);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                             .count();
+        std::cout << threads_count << " threads: " << threads_count * operations / seconds / 1e6
+                  << " Mops/s\n";
+    }
+}
+
+void MeasureBatchLookups(const std::vector<int>& keys) {
+    HashMap<int, int> map;
+    for (int key : keys) {
+        map[key] = key;
+    }
+    std::vector<int> lookups = keys;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937_64(2));
+    size_t found = 0;
+    bench_utils::Measure("Find", lookups.size(), [&] {
+        for (int key : lookups) {
+            found += map.Find(key) != map.end();
+        }
+    });
+    std::vector<HashMap<int, int>::iterator> iterators(lookups.size());
+    bench_utils::Measure("FindBatch", lookups.size(), [&] {
+        map.FindBatch(lookups, iterators);
+    });
+    std::unique_ptr<bool[]> contains(new bool[lookups.size()]);
+    bench_utils::Measure("ContainsBatch", lookups.size(), [&] {
+        map.ContainsBatch(lookups, std::span(contains.get(), lookups.size()));
+    });
+    found += std::count(contains.get(), contains.get() + lookups.size(), true);
+    bench_utils::Measure("FindInterleaved", lookups.size(), [&] {
+        map.FindInterleaved(lookups, iterators);
+    });
+    found += std::count_if(iterators.begin(), iterators.end(),
+                           [&](auto it) { return it != map.end(); });
+    std::cout << "found: " << found << "\n";
+}
+
+void BenchmarkBatchLookup() {
+    std::cout << "random keys\n";
+    MeasureBatchLookups(bench_utils::RandomKeys(1 << 23, 1));
+    // Multiples of 64 share their low bits, which only the finalizer spreads over the groups.
+    std::vector<int> strided(1 << 20);
+    for (size_t i = 0; i < strided.size(); ++i) {
+        strided[i] = static_cast<int>(i * 64);
+    }
+    std::cout << "strided keys\n";
+    MeasureBatchLookups(strided);
+}
+
+template <class Mix>
+void MeasureMix(const std::string& name, const std::vector<int>& keys) {
+    using Allocator = std::allocator<std::pair<const int, int>>;
+    HashMap<int, int, std::hash<int>, Allocator, Mix> map;
+    bench_utils::Measure(name + " insert", keys.size(), [&] {
+        for (int key : keys) {
+            map[key] = key;
+        }
+    });
+    std::vector<int> lookups = keys;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937_64(2));
+    size_t found = 0;
+    bench_utils::Measure(name + " lookup", lookups.size(), [&] {
+        for (int key : lookups) {
+            found += map.Find(key) != map.end();
+        }
+    });
+    std::cout << "found: " << found << "\n";
+}
+
+void BenchmarkMix() {
+    // Multiples of 1024 all land in the same few home groups under the identity std::hash<int>.
+    std::vector<int> strided(1 << 17);
+    for (size_t i = 0; i < strided.size(); ++i) {
+        strided[i] = static_cast<int>(i * 1'024);
+    }
+    std::vector<int> random = bench_utils::RandomKeys(1 << 22, 1);
+    for (const auto& [name, keys] : {std::pair{"strided", &strided}, {"random", &random}}) {
+        std::cout << name << " keys\n";
+        MeasureMix<hash_mix::Identity>("identity", *keys);
+        MeasureMix<hash_mix::Fmix64>("fmix64", *keys);
+        MeasureMix<hash_mix::Fibonacci>("fibonacci", *keys);
+        MeasureMix<hash_mix::Mum>("mum", *keys);
+    }
+}
+
+// Hashes a set of strings that fits into the cache over and over, so that only the hash costs.
+template <class Hash>
+void MeasureStringHash(const std::string& name, const std::vector<std::string>& strings) {
+    Hash hash;
+    size_t checksum = 0;
+    const size_t rounds = (size_t{1} << 28) / (strings.size() * (strings[0].size() + 16));
+    bench_utils::Measure(name, rounds * strings.size(), [&] {
+        for (size_t round = 0; round < rounds; ++round) {
+            for (const auto& string : strings) {
+                checksum += hash(string);
+            }
+        }
+    });
+    std::cout << "checksum: " << checksum << "\n";
+}
+
+template <class Hash>
+void MeasureUrlLookups(const std::string& name, const std::vector<std::string>& urls) {
+    HashMap<std::string, int, Hash> map;
+    for (size_t i = 0; i < urls.size(); ++i) {
+        map[urls[i]] = static_cast<int>(i);
+    }
+    std::vector<std::string> lookups = urls;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937_64(2));
+    size_t found = 0;
+    bench_utils::Measure(name, lookups.size(), [&] {
+        for (const auto& url : lookups) {
+            found += map.Find(url) != map.end();
+        }
+    });
+    std::cout << "found: " << found << "\n";
+}
+
+void BenchmarkStringHash() {
+    std::mt19937_64 rnd(1);
+    for (size_t length : {8, 16, 32, 64, 100, 256, 1'024, 4'096}) {
+        std::vector<std::string> strings(256);
+        for (auto& string : strings) {
+            for (size_t i = 0; i < length; ++i) {
+                string.push_back(static_cast<char>('a' + rnd() % 26));
+            }
+        }
+        std::cout << length << " bytes\n";
+        MeasureStringHash<std::hash<std::string>>("std::hash", strings);
+        MeasureStringHash<StringHash>("StringHash", strings);
+    }
+    std::vector<std::string> urls(1 << 20);
+    for (size_t i = 0; i < urls.size(); ++i) {
+        urls[i] = "https://example.com/api/v2/users/" + std::to_string(rnd() % 1'000'000) +
+                  "/orders?page=" + std::to_string(i);
+    }
+    MeasureUrlLookups<std::hash<std::string>>("std::hash URL lookup", urls);
+    MeasureUrlLookups<StringHash>("StringHash URL lookup", urls);
+}
+
+constexpr auto kHeaderIds = MakeFrozenHashMap<std::string_view, int>({
+    {"accept", 0},           {"accept-charset", 1},   {"accept-encoding", 2},
+    {"accept-language", 3},  {"authorization", 4},    {"cache-control", 5},
+    {"connection", 6},       {"content-encoding", 7}, {"content-length", 8},
+    {"content-type", 9},     {"cookie", 10},          {"date", 11},
+    {"etag", 12},            {"expect", 13},          {"forwarded", 14},
+    {"host", 15},            {"if-match", 16},        {"if-modified-since", 17},
+    {"if-none-match", 18},   {"if-range", 19},        {"origin", 20},
+    {"pragma", 21},          {"range", 22},           {"referer", 23},
+    {"te", 24},              {"trailer", 25},         {"transfer-encoding", 26},
+    {"upgrade", 27},         {"user-agent", 28},      {"via", 29},
+    {"x-forwarded-for", 30}, {"x-request-id", 31},
+});
+
+// Header name dispatch: a compile-time FrozenHashMap against a HashMap filled at startup, with one
+// lookup in nine missing.
+void BenchmarkFrozen() {
+    HashMap<std::string_view, int> map;
+    for (const auto& [name, id] : kHeaderIds) {
+        map[name] = id;
+    }
+    std::vector<std::string> names;
+    for (const auto& [name, id] : kHeaderIds) {
+        names.emplace_back(name);
+    }
+    names.resize(names.size() * 9 / 8, "x-unknown-header");
+    std::mt19937_64 rnd(3);
+    std::vector<std::string_view> lookups(1 << 20);
+    for (auto& lookup : lookups) {
+        lookup = names[rnd() % names.size()];
+    }
+    int sum = 0;
+    bench_utils::Measure("HashMap", lookups.size(), [&] {
+        for (std::string_view name : lookups) {
+            auto it = map.Find(name);
+            sum += it != map.end() ? it->second : -1;
+        }
+    });
+    bench_utils::Measure("FrozenHashMap", lookups.size(), [&] {
+        for (std::string_view name : lookups) {
+            auto it = kHeaderIds.Find(name);
+            sum += it != kHeaderIds.end() ? it->second : -1;
+        }
+    });
+    std::cout << "sum: " << sum << "\n";
+}
+
+// Lookups in a HashMap and in its frozen copy, for a table that fits in the cache and for one that
+// does not; the frozen copy holds the pairs densely, so it also takes fewer cache lines.
+void BenchmarkFreeze() {
+    for (size_t count : {size_t{1} << 14, size_t{1} << 22}) {
+        std::vector<int> keys = bench_utils::RandomKeys(count, 1);
+        HashMap<int, int> map;
+        for (int key : keys) {
+            map[key] = key;
+        }
+        std::cout << map.Size() << " keys\n";
+        std::optional<decltype(map.Freeze())> frozen;
+        bench_utils::Measure("Freeze", map.Size(), [&] { frozen.emplace(map.Freeze()); });
+        std::vector<int> lookups = keys;
+        std::shuffle(lookups.begin(), lookups.end(), std::mt19937_64(2));
+        const size_t rounds = (size_t{1} << 24) / lookups.size();
+        size_t found = 0;
+        bench_utils::Measure("HashMap", rounds * lookups.size(), [&] {
+            for (size_t round = 0; round < rounds; ++round) {
+                for (int key : lookups) {
+                    found += map.Find(key) != map.end();
+                }
+            }
+        });
+        bench_utils::Measure("FrozenMap", rounds * lookups.size(), [&] {
+            for (size_t round = 0; round < rounds; ++round) {
+                for (int key : lookups) {
+                    found += frozen->Find(key) != frozen->end();
+                }
+            }
+        });
+        std::cout << "found: " << found << "\n";
+    }
+}
+
+void BenchmarkBatchInsert() {
+    const size_t batch_size = 10'000;
+    std::vector<int> keys = bench_utils::RandomKeys(1 << 23, 1);
+    std::vector<std::vector<std::pair<int, int>>> batches(keys.size() / batch_size);
+    for (size_t i = 0; i < batches.size() * batch_size; ++i) {
+        batches[i / batch_size].push_back({keys[i], keys[i]});
+    }
+    size_t size = 0;
+    bench_utils::Measure("Insert", batches.size() * batch_size, [&] {
+        HashMap<int, int> map;
+        for (const auto& batch : batches) {
+            for (const auto& item : batch) {
+                map.Insert(item);
+            }
+        }
+        size += map.Size();
+    });
+    bench_utils::Measure("InsertBatch", batches.size() * batch_size, [&] {
+        HashMap<int, int> map;
+        for (const auto& batch : batches) {
+            map.InsertBatch(batch);
+        }
+        size += map.Size();
+    });
+    std::cout << "size: " << size << "\n";
+}
+
+void BenchmarkBulkBuild() {
+    std::vector<int> keys = bench_utils::RandomKeys(1 << 23, 1);
+    std::vector<std::pair<int, int>> items;
+    for (int key : keys) {
+        items.push_back({key, key});
+    }
+    size_t size = 0;
+    bench_utils::Measure("range constructor", items.size(), [&] {
+        HashMap<int, int> map(items.begin(), items.end());
+        size += map.Size();
+    });
+    bench_utils::Measure("BulkBuild", items.size(), [&] {
+        size += HashMap<int, int>::BulkBuild(items.begin(), items.end()).Size();
+    });
+    std::cout << "size: " << size << "\n";
+}
+
+int main(int argc, char** argv) {
+    const std::vector<std::pair<std::string, void (*)()>> benchmarks = {
+        {"layout", BenchmarkLayout},
+        {"huge_pages", BenchmarkHugePages},
+        {"sharded", BenchmarkSharded},
+        {"bulk_build", BenchmarkBulkBuild},
+        {"batch_lookup", BenchmarkBatchLookup},
+        {"batch_insert", BenchmarkBatchInsert},
+        {"mix", BenchmarkMix},
+        {"string_hash", BenchmarkStringHash},
+        {"frozen", BenchmarkFrozen},
+        {"freeze", BenchmarkFreeze},
+    };
+    for (const auto& [name, benchmark] : benchmarks) {
+        if (argc == 1 || name == argv[1]) {
+            std::cout << "== " << name << "\n";
+            benchmark();
+        }
+    }
+}
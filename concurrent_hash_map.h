@@ -0,0 +1,346 @@
+#pragma once
+#include "epoch_reclamation.h"
+#include "hash_mix.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Open-addressing map whose readers take no locks. A writer claims an empty slot by CAS on its
+// control byte, fills it and publishes it with a release store; published slots are never
+// modified, erasing only turns them into tombstones.
+//
+// Growth is cooperative: the writer that finds the table overloaded links a successor table, and
+// every writer that runs into the old table claims chunks of slots and moves them over, marking
+// each moved slot so that writers continue in the successor. A moved slot keeps its pair, so
+// readers finish their scan in the table they started in. The thread that finishes the last chunk
+// publishes the successor and retires the old table through epoch-based reclamation.
+// A helper whose copy into the successor throws puts the slot back, hands its chunk over to the
+// other helpers and rethrows; moving a slot twice is a no-op, so the chunk can simply start over.
+//
+// Concurrent inserters may fill a table completely, and a transferred table keeps every moved
+// slot non-empty, so probes stop after a pass over the table rather than only at an empty slot.
+// Mix finalizes every hash before it picks a home slot, unless Hash is marked as avalanching.
+template <class KeyType, class ValueType, class Hash = std::hash<KeyType>,
+          class Mix = hash_mix::Fmix64>
+class ConcurrentHashMap {
+public:
+    ConcurrentHashMap(Hash hash = Hash()) : hash_(hash) {
+        table_.store(new Table(kInitialSize));
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    // A transfer left unfinished by a throwing copy leaves an unpublished successor behind.
+    ~ConcurrentHashMap() {
+        Table* table = table_.load();
+        delete table->next.load();
+        delete table;
+        EpochManager::Instance().Reclaim();
+    }
+
+    template <class Callback>
+    bool Find(const KeyType& key, Callback callback) const {
+        EpochGuard guard;
+        const Table* table = table_.load();
+        size_t index = HomeSlot(table, key);
+        for (size_t probes = 0; probes < table->capacity; ++probes) {
+            // Following a moved slot to the successor could skip pairs of chunks that are not
+            // moved yet.
+            uint8_t control =
+                table->control[index].load(std::memory_order_acquire) & ~kMovedFlag;
+            if (control == kEmpty) {
+                return false;
+            }
+            if ((control == kFull || control == kCopying) && table->Slot(index).first == key) {
+                callback(table->Slot(index).second);
+                return true;
+            }
+            index = (index + 1) & (table->capacity - 1);
+        }
+        return false;
+    }
+
+    bool Contains(const KeyType& key) const {
+        return Find(key, [](const ValueType&) {});
+    }
+
+    bool Insert(const std::pair<KeyType, ValueType>& item) {
+        EpochGuard guard;
+        Table* table = table_.load();
+        while (true) {
+            if (table->next.load() == nullptr && Overloaded(table)) {
+                StartTransfer(table);
+            }
+            if (table->next.load() != nullptr) {
+                table = HelpTransfer(table);
+                continue;
+            }
+            InsertResult result = TryInsert(table, item);
+            if (result == InsertResult::kMoved) {
+                continue;
+            }
+            if (result == InsertResult::kFull) {
+                StartTransfer(table);
+                continue;
+            }
+            if (result == InsertResult::kInserted) {
+                size_.fetch_add(1);
+            }
+            return result == InsertResult::kInserted;
+        }
+    }
+
+    bool Erase(const KeyType& key) {
+        EpochGuard guard;
+        Table* table = table_.load();
+        size_t index = HomeSlot(table, key);
+        for (size_t probes = 0;;) {
+            uint8_t control = kMovedFlag;
+            if (probes < table->capacity) {
+                control = WaitWhileBusy(table, index);
+            } else if (table->next.load() == nullptr) {
+                // A full pass without the key and no transfer that could have moved it.
+                return false;
+            }
+            if (control & kMovedFlag) {
+                table = HelpTransfer(table);
+                index = HomeSlot(table, key);
+                probes = 0;
+                continue;
+            }
+            if (control == kEmpty) {
+                return false;
+            }
+            if (control == kFull && table->Slot(index).first == key) {
+                if (table->control[index].compare_exchange_strong(control, kDeleted)) {
+                    size_.fetch_sub(1);
+                    return true;
+                }
+                continue;
+            }
+            index = (index + 1) & (table->capacity - 1);
+            ++probes;
+        }
+    }
+
+    size_t Size() const {
+        return size_.load();
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    Hash HashFunction() const {
+        return hash_;
+    }
+
+private:
+    constexpr static const uint8_t kEmpty = 0;
+    constexpr static const uint8_t kFull = 1;
+    constexpr static const uint8_t kDeleted = 2;
+    constexpr static const uint8_t kBusy = 3;
+    // A full slot that is being copied to the successor table: still readable, but frozen.
+    constexpr static const uint8_t kCopying = 4;
+    // Set on every slot of a transferred range; the low bits keep whether a pair lives there.
+    constexpr static const uint8_t kMovedFlag = 0x80;
+    constexpr static const size_t kInitialSize = 16;
+    constexpr static const size_t kTransferChunk = 256;
+    constexpr static const size_t kNoChunk = static_cast<size_t>(-1);
+    constexpr static const size_t kTopLoadFactor = 50;
+    constexpr static const size_t kMaxPercent = 100;
+    using AppliedMix = std::conditional_t<is_avalanching_v<Hash>, hash_mix::Identity, Mix>;
+
+    enum class InsertResult { kInserted, kPresent, kMoved, kFull };
+
+    // Slots are constructed when claimed and destroyed together with the table, because readers
+    // may still be looking at a slot after it is erased or moved.
+    struct Table {
+        size_t capacity;
+        std::atomic<size_t> used{0};
+        std::unique_ptr<std::atomic<uint8_t>[]> control;
+        std::pair<KeyType, ValueType>* slots;
+        std::atomic<Table*> next{nullptr};
+        std::atomic<size_t> transfer_index{0};
+        std::atomic<size_t> transferred{0};
+        // Chunks given up by helpers whose copy threw, to be claimed again.
+        std::mutex released_mutex;
+        std::vector<size_t> released_chunks;
+        std::atomic<size_t> released_count{0};
+
+        explicit Table(size_t capacity)
+            : capacity(capacity), control(new std::atomic<uint8_t>[capacity]) {
+            for (size_t i = 0; i < capacity; ++i) {
+                control[i].store(kEmpty, std::memory_order_relaxed);
+            }
+            slots = static_cast<std::pair<KeyType, ValueType>*>(
+                ::operator new(capacity * sizeof(std::pair<KeyType, ValueType>),
+                               std::align_val_t{alignof(std::pair<KeyType, ValueType>)}));
+        }
+
+        ~Table() {
+            for (size_t i = 0; i < capacity; ++i) {
+                if ((control[i].load(std::memory_order_relaxed) & ~kMovedFlag) != kEmpty) {
+                    slots[i].~pair();
+                }
+            }
+            ::operator delete(slots, std::align_val_t{alignof(std::pair<KeyType, ValueType>)});
+        }
+
+        std::pair<KeyType, ValueType>& Slot(size_t index) const {
+            return slots[index];
+        }
+    };
+
+    Hash hash_;
+    std::atomic<Table*> table_;
+    std::atomic<size_t> size_{0};
+
+    size_t HomeSlot(const Table* table, const KeyType& key) const {
+        return static_cast<size_t>(AppliedMix()(hash_(key))) & (table->capacity - 1);
+    }
+
+    static uint8_t WaitWhileBusy(const Table* table, size_t index) {
+        uint8_t control;
+        while ((control = table->control[index].load(std::memory_order_acquire)) == kBusy ||
+               control == kCopying) {
+            std::this_thread::yield();
+        }
+        return control;
+    }
+
+    // Tombstones are never reused, so every slot ever claimed counts towards the load.
+    static bool Overloaded(const Table* table) {
+        return kMaxPercent * (table->used.load() + 1) > kTopLoadFactor * table->capacity;
+    }
+
+    // Overloaded() is checked before a slot is claimed, so concurrent inserters may still fill the
+    // table; after a probe over every slot the caller starts a transfer instead of spinning. A
+    // successor is never smaller than its table, so moving slots into it cannot run out of room.
+    InsertResult TryInsert(Table* table, const std::pair<KeyType, ValueType>& item) {
+        size_t index = HomeSlot(table, item.first);
+        for (size_t probes = 0; probes < table->capacity;) {
+            uint8_t control = WaitWhileBusy(table, index);
+            if (control & kMovedFlag) {
+                return InsertResult::kMoved;
+            }
+            if (control == kFull && table->Slot(index).first == item.first) {
+                return InsertResult::kPresent;
+            }
+            if (control != kEmpty) {
+                index = (index + 1) & (table->capacity - 1);
+                ++probes;
+                continue;
+            }
+            if (!table->control[index].compare_exchange_strong(control, kBusy)) {
+                continue;
+            }
+            try {
+                new (table->slots + index) std::pair<KeyType, ValueType>(item);
+            } catch (...) {
+                table->control[index].store(kEmpty, std::memory_order_release);
+                throw;
+            }
+            table->control[index].store(kFull, std::memory_order_release);
+            table->used.fetch_add(1);
+            return InsertResult::kInserted;
+        }
+        return InsertResult::kFull;
+    }
+
+    void StartTransfer(Table* table) {
+        if (table->next.load() != nullptr) {
+            return;
+        }
+        size_t capacity = table->capacity;
+        if (kMaxPercent * (size_.load() + 1) * 2 > kTopLoadFactor * capacity) {
+            capacity *= 2;
+        }
+        Table* expected = nullptr;
+        auto next = std::make_unique<Table>(capacity);
+        if (table->next.compare_exchange_strong(expected, next.get())) {
+            next.release();
+        }
+    }
+
+    // Moves chunks of table until none are left, waits for the other helpers to finish theirs and
+    // returns the published successor. While waiting it picks up chunks that other helpers gave up.
+    Table* HelpTransfer(Table* table) {
+        Table* next = table->next.load();
+        Table* current;
+        while ((current = table_.load()) == table) {
+            size_t start = ClaimChunk(table);
+            if (start == kNoChunk) {
+                std::this_thread::yield();
+                continue;
+            }
+            size_t finish = std::min(start + kTransferChunk, table->capacity);
+            try {
+                for (size_t index = start; index < finish; ++index) {
+                    TransferSlot(table, next, index);
+                }
+            } catch (...) {
+                std::lock_guard lock(table->released_mutex);
+                table->released_chunks.push_back(start);
+                table->released_count.fetch_add(1);
+                throw;
+            }
+            if (table->transferred.fetch_add(finish - start) + (finish - start) ==
+                table->capacity) {
+                table_.store(next);
+                EpochManager::Instance().Retire([table] { delete table; });
+            }
+        }
+        return current;
+    }
+
+    static size_t ClaimChunk(Table* table) {
+        if (table->transfer_index.load() < table->capacity) {
+            size_t start = table->transfer_index.fetch_add(kTransferChunk);
+            if (start < table->capacity) {
+                return start;
+            }
+        }
+        if (table->released_count.load() == 0) {
+            return kNoChunk;
+        }
+        std::lock_guard lock(table->released_mutex);
+        if (table->released_chunks.empty()) {
+            return kNoChunk;
+        }
+        size_t start = table->released_chunks.back();
+        table->released_chunks.pop_back();
+        table->released_count.fetch_sub(1);
+        return start;
+    }
+
+    void TransferSlot(Table* table, Table* next, size_t index) {
+        std::atomic<uint8_t>& control = table->control[index];
+        while (true) {
+            uint8_t state = WaitWhileBusy(table, index);
+            if (state == kFull) {
+                if (!control.compare_exchange_strong(state, kCopying)) {
+                    continue;
+                }
+                try {
+                    TryInsert(next, table->Slot(index));
+                } catch (...) {
+                    control.store(kFull, std::memory_order_release);
+                    throw;
+                }
+                control.store(kFull | kMovedFlag, std::memory_order_release);
+                return;
+            }
+            if (control.compare_exchange_strong(state, state | kMovedFlag)) {
+                return;
+            }
+        }
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <initializer_list>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_DISPATCH_X86 1
+#endif
+
+// Runtime choice of the widest instruction set the host supports, shared by every SIMD kernel, so
+// one binary built for the baseline ISA still runs AVX2 or AVX-512 code where it can. Kernels are
+// compiled per level with target attributes and picked through SelectKernel. The HASH_MAP_SIMD
+// environment variable (scalar, sse2, avx2 or avx512) caps the level, e.g. to compare kernels on
+// one machine.
+enum class SimdLevel { kScalar, kSse2, kAvx2, kAvx512 };
+
+namespace cpu_dispatch {
+
+inline SimdLevel DetectSimdLevel() {
+#ifdef CPU_DISPATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::kAvx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::kAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::kSse2;
+    }
+#endif
+    return SimdLevel::kScalar;
+}
+
+// Unknown names leave the level uncapped.
+inline SimdLevel ParseSimdLevel(std::string_view name) {
+    if (name == "scalar") {
+        return SimdLevel::kScalar;
+    }
+    if (name == "sse2") {
+        return SimdLevel::kSse2;
+    }
+    if (name == "avx2") {
+        return SimdLevel::kAvx2;
+    }
+    return SimdLevel::kAvx512;
+}
+
+inline SimdLevel ActiveSimdLevel() {
+    static const SimdLevel level = [] {
+        SimdLevel detected = DetectSimdLevel();
+        if (const char* cap = std::getenv("HASH_MAP_SIMD")) {
+            detected = std::min(detected, ParseSimdLevel(cap));
+        }
+        return detected;
+    }();
+    return level;
+}
+
+// kernels lists one kernel per level starting from scalar, nullptr for levels without one; the
+// widest kernel not above level is returned.
+template <class Kernel>
+Kernel SelectKernel(std::initializer_list<Kernel> kernels, SimdLevel level = ActiveSimdLevel()) {
+    size_t index = std::min(static_cast<size_t>(level), kernels.size() - 1);
+    while (index > 0 && kernels.begin()[index] == nullptr) {
+        --index;
+    }
+    return kernels.begin()[index];
+}
+}  // namespace cpu_dispatch
@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Process-wide epoch-based reclamation. A thread that holds an EpochGuard announces the global
+// epoch it entered in; memory retired afterwards is freed only once every announced epoch is newer
+// than the retirement, i.e. once no guard that could have seen the memory is still alive.
+class EpochManager {
+public:
+    static EpochManager& Instance() {
+        static EpochManager manager;
+        return manager;
+    }
+
+    void Enter() {
+        ThreadRecord& record = Record();
+        if (record.depth++ == 0) {
+            slots_[record.slot].epoch.store(epoch_.load(), std::memory_order_seq_cst);
+        }
+    }
+
+    void Exit() {
+        ThreadRecord& record = Record();
+        if (--record.depth == 0) {
+            slots_[record.slot].epoch.store(kInactive, std::memory_order_release);
+        }
+    }
+
+    // The caller must have unpublished the memory before retiring it.
+    void Retire(std::function<void()> deleter) {
+        std::lock_guard lock(mutex_);
+        retired_.emplace_back(epoch_.fetch_add(1), std::move(deleter));
+        ReclaimLocked();
+    }
+
+    void Reclaim() {
+        std::lock_guard lock(mutex_);
+        ReclaimLocked();
+    }
+
+private:
+    constexpr static const size_t kCacheLine = 64;
+    constexpr static const size_t kMaxThreads = 1024;
+    constexpr static const uint64_t kInactive = 0;
+
+    struct alignas(kCacheLine) Slot {
+        std::atomic<uint64_t> epoch{kInactive};
+        std::atomic<bool> taken{false};
+    };
+
+    struct ThreadRecord {
+        size_t slot;
+        size_t depth = 0;
+
+        explicit ThreadRecord(EpochManager& manager) : slot(manager.AcquireSlot()) {
+        }
+
+        ~ThreadRecord() {
+            Instance().slots_[slot].taken.store(false, std::memory_order_release);
+        }
+    };
+
+    std::atomic<uint64_t> epoch_{1};
+    Slot slots_[kMaxThreads];
+    std::mutex mutex_;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired_;
+
+    ThreadRecord& Record() {
+        thread_local ThreadRecord record(*this);
+        return record;
+    }
+
+    size_t AcquireSlot() {
+        for (size_t i = 0; i < kMaxThreads; ++i) {
+            bool taken = false;
+            if (slots_[i].taken.compare_exchange_strong(taken, true)) {
+                return i;
+            }
+        }
+        throw std::runtime_error("Too many threads for epoch-based reclamation");
+    }
+
+    void ReclaimLocked() {
+        uint64_t oldest = epoch_.load();
+        for (const Slot& slot : slots_) {
+            uint64_t epoch = slot.epoch.load();
+            if (epoch != kInactive && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < retired_.size(); ++i) {
+            if (retired_[i].first < oldest) {
+                retired_[i].second();
+            } else if (kept++ != i) {
+                std::swap(retired_[kept - 1], retired_[i]);
+            }
+        }
+        retired_.resize(kept);
+    }
+};
+
+class EpochGuard {
+public:
+    EpochGuard() {
+        EpochManager::Instance().Enter();
+    }
+
+    ~EpochGuard() {
+        EpochManager::Instance().Exit();
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
@@ -0,0 +1,303 @@
+#pragma once
+#include "hash_mix.h"
+#include "sip_hash.h"
+#include "string_hash.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Minimal perfect hashing in the style of CHD (hash and displace) for a fixed set of distinct
+// 64-bit hashes. They are split into buckets of about kKeysPerBucket, and each bucket, the largest
+// first, searches for a displacement that sends all its hashes to free positions under
+// fmix64(hash ^ displacement). As in PTHash, there are a few more positions than hashes, which
+// keeps the last buckets from searching a nearly full table; the hashes that land beyond the end
+// are remapped to the slots left free. A slot costs one displacement load and one fmix64 on top of
+// the hash, plus a remap load for the few hashes beyond the end.
+namespace chd {
+
+// Buckets of about four keys keep the displacements at a byte per key while the largest
+// buckets, placed first into a still sparse table, find their displacement quickly.
+constexpr size_t kKeysPerBucket = 4;
+// One extra position per this many hashes.
+constexpr size_t kKeysPerExtraPosition = 16;
+
+constexpr size_t BucketCount(size_t size) {
+    return (size + kKeysPerBucket - 1) / kKeysPerBucket;
+}
+
+constexpr size_t ExtraPositions(size_t size) {
+    return size / kKeysPerExtraPosition;
+}
+
+// Maps a hash uniformly to [0, range) with a multiplication instead of a division.
+constexpr size_t Reduce(uint64_t hash, size_t range) {
+    __extension__ using Product = unsigned __int128;
+    return static_cast<size_t>((static_cast<Product>(hash) * range) >> 64);
+}
+
+constexpr size_t PositionOf(uint64_t hash, uint32_t displacement, size_t size) {
+    return Reduce(hash_mix::Fmix64()(hash ^ displacement), size + ExtraPositions(size));
+}
+
+constexpr size_t SlotOf(uint64_t hash, std::span<const uint32_t> displacements,
+                        std::span<const uint32_t> remap, size_t size) {
+    size_t position = PositionOf(hash, displacements[Reduce(hash, displacements.size())], size);
+    return position < size ? position : remap[position - size];
+}
+
+// Fills displacements, BucketCount(hashes.size()) of them, and remap, ExtraPositions of them, so
+// that SlotOf sends the hashes to distinct slots. Equal hashes cannot be separated and throw
+// std::invalid_argument; same_key(i, j) tells a duplicate key from a collision for the message.
+template <class SameKey>
+constexpr void Build(std::span<const uint64_t> hashes, std::span<uint32_t> displacements,
+                     std::span<uint32_t> remap, SameKey same_key) {
+    size_t size = hashes.size(), buckets = displacements.size();
+    if (size > UINT32_MAX) {
+        throw std::length_error("Too many keys for a perfect hash");
+    }
+    std::vector<size_t> bucket_begin(buckets + 1);
+    for (uint64_t hash : hashes) {
+        ++bucket_begin[Reduce(hash, buckets) + 1];
+    }
+    std::partial_sum(bucket_begin.begin(), bucket_begin.end(), bucket_begin.begin());
+    std::vector<size_t> order(size), next(bucket_begin.begin(), bucket_begin.end() - 1);
+    for (size_t i = 0; i < size; ++i) {
+        order[next[Reduce(hashes[i], buckets)]++] = i;
+    }
+
+    std::vector<size_t> by_size(buckets);
+    std::iota(by_size.begin(), by_size.end(), 0);
+    auto bucket_size = [&](size_t bucket) {
+        return bucket_begin[bucket + 1] - bucket_begin[bucket];
+    };
+    std::sort(by_size.begin(), by_size.end(),
+              [&](size_t a, size_t b) { return bucket_size(a) > bucket_size(b); });
+    // Buckets try many displacements, so the taken positions are a bitset that stays in cache.
+    std::vector<uint64_t> taken((size + remap.size() + 63) / 64);
+    auto position = [&](size_t i, uint64_t displacement) {
+        return PositionOf(hashes[order[i]], static_cast<uint32_t>(displacement), size);
+    };
+    auto is_taken = [&](size_t position) { return (taken[position / 64] >> (position % 64)) & 1; };
+    auto flip = [&](size_t position) { taken[position / 64] ^= uint64_t{1} << (position % 64); };
+    for (size_t bucket : by_size) {
+        size_t begin = bucket_begin[bucket], end = bucket_begin[bucket + 1];
+        for (size_t i = begin; i < end; ++i) {
+            for (size_t j = begin; j < i; ++j) {
+                if (hashes[order[i]] == hashes[order[j]]) {
+                    throw std::invalid_argument(same_key(order[i], order[j])
+                                                    ? "Duplicate key"
+                                                    : "Keys with equal hashes");
+                }
+            }
+        }
+        // Displacements are tried in order; a failed attempt releases the positions it took.
+        uint64_t displacement = 0;
+        for (;; ++displacement) {
+            if (displacement > UINT32_MAX) {
+                throw std::length_error("No displacement places the bucket");
+            }
+            size_t placed = begin;
+            while (placed < end && !is_taken(position(placed, displacement))) {
+                flip(position(placed++, displacement));
+            }
+            if (placed == end) {
+                break;
+            }
+            while (placed-- > begin) {
+                flip(position(placed, displacement));
+            }
+        }
+        displacements[bucket] = static_cast<uint32_t>(displacement);
+    }
+    // Positions beyond the end that no hash took keep remapping to slot 0; a lookup that lands
+    // there compares against a key that hashes elsewhere, so it misses as it should.
+    for (size_t extra = 0, free = 0; extra < remap.size(); ++extra) {
+        if (is_taken(size + extra)) {
+            while (is_taken(free)) {
+                ++free;
+            }
+            remap[extra] = static_cast<uint32_t>(free++);
+        }
+    }
+}
+}  // namespace chd
+
+// Integral keys are finalized with fmix64 and strings hashed with StringHash; both can run at
+// compile time.
+template <class KeyType>
+using FrozenHash = std::conditional_t<std::is_integral_v<KeyType>, hash_mix::Fmix64, StringHash>;
+
+// Read-only map over a fixed set of N pairs, placed by a CHD perfect hash that the constructor
+// computes, at compile time when the map is constexpr. A lookup is one hash, one displacement load
+// and one key comparison. Lookups never probe, so keys chosen by an attacker cannot slow them down
+// and the hash needs no seed.
+template <class KeyType, class ValueType, size_t N, class Hash = FrozenHash<KeyType>>
+class FrozenHashMap {
+    static_assert(N > 0, "A frozen map needs at least one key");
+
+public:
+    using const_iterator = const std::pair<KeyType, ValueType>*;
+
+    // Throws std::invalid_argument on duplicate keys and on distinct keys with equal hashes,
+    // which no displacement can separate; at compile time either is a compilation error.
+    constexpr explicit FrozenHashMap(std::span<const std::pair<KeyType, ValueType>, N> items,
+                                     Hash hash = Hash())
+        : hash_(hash) {
+        std::array<uint64_t, N> hashes{};
+        for (size_t i = 0; i < N; ++i) {
+            hashes[i] = hash_(items[i].first);
+        }
+        chd::Build(hashes, displacements_, remap_,
+                   [&](size_t i, size_t j) { return items[i].first == items[j].first; });
+        for (size_t i = 0; i < N; ++i) {
+            slots_[chd::SlotOf(hashes[i], displacements_, remap_, N)] = items[i];
+        }
+    }
+
+    constexpr const_iterator Find(const KeyType& key) const {
+        const auto& item = slots_[chd::SlotOf(hash_(key), displacements_, remap_, N)];
+        return item.first == key ? &item : end();
+    }
+
+    constexpr const ValueType& At(const KeyType& key) const {
+        const_iterator it = Find(key);
+        if (it == end()) {
+            throw std::out_of_range("The key doesn't exist");
+        }
+        return it->second;
+    }
+
+    constexpr size_t Size() const {
+        return N;
+    }
+
+    constexpr const_iterator begin() const {  // NOLINT
+        return slots_.data();
+    }
+    constexpr const_iterator end() const {  // NOLINT
+        return slots_.data() + N;
+    }
+
+private:
+    [[no_unique_address]] Hash hash_;
+    std::array<uint32_t, chd::BucketCount(N)> displacements_{};
+    std::array<uint32_t, chd::ExtraPositions(N)> remap_{};
+    std::array<std::pair<KeyType, ValueType>, N> slots_{};
+};
+
+// Deduces the size from a braced list of pairs, e.g.
+// constexpr auto kCodes = MakeFrozenHashMap<std::string_view, int>({{"GET", 1}, {"PUT", 2}});
+template <class KeyType, class ValueType, class Hash = FrozenHash<KeyType>, size_t N>
+constexpr FrozenHashMap<KeyType, ValueType, N, Hash> MakeFrozenHashMap(
+    const std::pair<KeyType, ValueType> (&items)[N], Hash hash = Hash()) {
+    return FrozenHashMap<KeyType, ValueType, N, Hash>(items, hash);
+}
+
+// Read-only map built at run time, e.g. by HashMap::Freeze(), with a CHD minimal perfect hash:
+// the pairs fill an array exactly, without control bytes, and a lookup costs one hash, one
+// displacement load and one key comparison. Keys are hashed under a seed like in HashMap, but
+// always finalized with fmix64 unless Hash avalanches, because buckets are picked by the high bits.
+// Snapshots of a table that switched to SipHash keep hashing with it.
+template <class KeyType, class ValueType, class Hash,
+          class Allocator = std::allocator<std::pair<const KeyType, ValueType>>>
+class FrozenMap {
+    using AllocatorTraits = std::allocator_traits<Allocator>;
+    using PairAllocator =
+        typename AllocatorTraits::template rebind_alloc<std::pair<KeyType, ValueType>>;
+    using DisplacementAllocator = typename AllocatorTraits::template rebind_alloc<uint32_t>;
+    using Mix = std::conditional_t<is_avalanching_v<Hash>, hash_mix::Identity, hash_mix::Fmix64>;
+    constexpr static const bool kSipHashable =
+        std::is_invocable_v<const SipHash&, const KeyType&, uint64_t>;
+
+public:
+    using const_iterator = const std::pair<KeyType, ValueType>*;
+
+    // Throws std::invalid_argument on duplicate keys and on distinct keys with equal hashes.
+    template <class Iterator>
+    FrozenMap(Iterator begin, Iterator end, Hash hash = Hash(), uint64_t seed = 0,
+              bool sip_hashed = false, const Allocator& allocator = Allocator())
+        : hash_(hash),
+          seed_(seed),
+          sip_hashed_(sip_hashed),
+          displacements_(allocator),
+          remap_(allocator),
+          slots_(allocator) {
+        if constexpr (!kSipHashable) {
+            if (sip_hashed) {
+                throw std::invalid_argument("SipHash does not take these keys");
+            }
+        }
+        std::vector<std::pair<KeyType, ValueType>, PairAllocator> items(allocator);
+        std::vector<uint64_t> hashes;
+        for (auto it = begin; it != end; ++it) {
+            items.emplace_back(*it);
+            hashes.push_back(HashOf(items.back().first));
+        }
+        displacements_.resize(chd::BucketCount(items.size()));
+        remap_.resize(chd::ExtraPositions(items.size()));
+        chd::Build(hashes, displacements_, remap_,
+                   [&](size_t i, size_t j) { return items[i].first == items[j].first; });
+        slots_.resize(items.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            slots_[chd::SlotOf(hashes[i], displacements_, remap_, slots_.size())] =
+                std::move(items[i]);
+        }
+    }
+
+    const_iterator Find(const KeyType& key) const {
+        if (slots_.empty()) {
+            return end();
+        }
+        const auto& item =
+            slots_[chd::SlotOf(HashOf(key), displacements_, remap_, slots_.size())];
+        return item.first == key ? &item : end();
+    }
+
+    const ValueType& At(const KeyType& key) const {
+        const_iterator it = Find(key);
+        if (it == end()) {
+            throw std::out_of_range("The key doesn't exist");
+        }
+        return it->second;
+    }
+
+    size_t Size() const {
+        return slots_.size();
+    }
+
+    bool Empty() const {
+        return slots_.empty();
+    }
+
+    const_iterator begin() const {  // NOLINT
+        return slots_.data();
+    }
+    const_iterator end() const {  // NOLINT
+        return slots_.data() + slots_.size();
+    }
+
+private:
+    Hash hash_;
+    uint64_t seed_;
+    bool sip_hashed_;
+    std::vector<uint32_t, DisplacementAllocator> displacements_;
+    std::vector<uint32_t, DisplacementAllocator> remap_;
+    std::vector<std::pair<KeyType, ValueType>, PairAllocator> slots_;
+
+    uint64_t HashOf(const KeyType& key) const {
+        if constexpr (kSipHashable) {
+            if (sip_hashed_) [[unlikely]] {
+                return SipHash()(key, seed_);
+            }
+        }
+        return hash_mix::SeededHash<Mix>(hash_, key, seed_);
+    }
+};
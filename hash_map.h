@@ -1,53 +1,137 @@
 #pragma once
+#include "frozen_hash_map.h"
+#include "hash_mix.h"
+#include "probe_kernels.h"
+#include "sip_hash.h"
+#include "string_hash.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <ranges>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-template <class KeyType, class ValueType, class Hash = std::hash<KeyType>>
+template <class KeyType>
+constexpr bool kStringKey = false;
+
+template <class Allocator>
+constexpr bool kStringKey<std::basic_string<char, std::char_traits<char>, Allocator>> = true;
+
+template <>
+constexpr bool kStringKey<std::string_view> = true;
+
+// String keys are hashed with StringHash, everything else with std::hash.
+template <class KeyType>
+using DefaultHash = std::conditional_t<kStringKey<KeyType>, StringHash, std::hash<KeyType>>;
+
+// Thread count of the parallel paths, i.e. the rebuild of large tables and BulkBuild: all hardware
+// threads unless SetThreadCount has chosen another, e.g. to run them on a single-core host in
+// tests. Zero restores the default.
+namespace hash_map_parallel {
+
+inline std::atomic<size_t>& ThreadCountOverride() {
+    static std::atomic<size_t> threads_count = 0;
+    return threads_count;
+}
+
+inline size_t ThreadCount() {
+    size_t threads_count = ThreadCountOverride().load(std::memory_order_relaxed);
+    return threads_count != 0 ? threads_count : std::thread::hardware_concurrency();
+}
+
+inline void SetThreadCount(size_t threads_count) {
+    ThreadCountOverride().store(threads_count, std::memory_order_relaxed);
+}
+}  // namespace hash_map_parallel
+
+// Occupancy and probe lengths of a HashMap, from HashMap::Stats(). A probe length is the number
+// of groups a lookup of a present key scans. A key is in a long cluster if its probe sequence
+// starts with at least kLongClusterGroups groups without an empty slot, all of which a lookup of an
+// absent key with the same home group and stride scans. Both grow when the hash spreads keys badly
+// or tombstones pile up.
+struct HashMapStats {
+    constexpr static const size_t kLongClusterGroups = 8;
+
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t tombstones = 0;
+    double average_probe_length = 0;
+    size_t max_probe_length = 0;
+    // probe_length_histogram[i] keys are found after scanning i + 1 groups.
+    std::vector<size_t> probe_length_histogram;
+    size_t keys_in_long_clusters = 0;
+};
+
+// Mix finalizes every hash before it picks a group, unless Hash is marked as avalanching.
+template <class KeyType, class ValueType, class Hash = DefaultHash<KeyType>,
+          class Allocator = std::allocator<std::pair<const KeyType, ValueType>>,
+          class Mix = hash_mix::Fmix64>
 class HashMap {
+    struct Group;
+    using AllocatorTraits = std::allocator_traits<Allocator>;
+
 public:
-    HashMap(Hash hash = Hash()) : hash_(hash) {
-        InitMemory(kInitialSize);
+    HashMap(Hash hash = Hash(), const Allocator& allocator = Allocator())
+        : hash_(hash), allocator_(allocator) {
+        InitMemory(kInitialSize, hash_mix::RandomSeed());
+    }
+
+    explicit HashMap(const Allocator& allocator) : HashMap(Hash(), allocator) {
     }
 
     template <typename init_iterator>
-    HashMap(init_iterator begin, init_iterator end, Hash hash = Hash()) : hash_(hash) {
-        InitMemory(kInitialSize);
+    HashMap(init_iterator begin, init_iterator end, Hash hash = Hash(),
+            const Allocator& allocator = Allocator())
+        : hash_(hash), allocator_(allocator) {
+        InitMemory(kInitialSize, hash_mix::RandomSeed());
         for (auto it = begin; it != end; it++) {
             Insert(*it);
         }
     }
 
     HashMap(const std::initializer_list<std::pair<KeyType, ValueType>>& initial_list,
-            Hash hash = Hash())
-        : hash_(hash) {
-        InitMemory(kInitialSize);
+            Hash hash = Hash(), const Allocator& allocator = Allocator())
+        : hash_(hash), allocator_(allocator) {
+        InitMemory(kInitialSize, hash_mix::RandomSeed());
         for (auto it = initial_list.begin(); it != initial_list.end(); it++) {
             Insert(*it);
         }
     }
 
     HashMap(const HashMap& other)
-        : hash_(other.hash_), size_(other.size_), capacity_(other.capacity_) {
+        : HashMap(other, AllocatorTraits::select_on_container_copy_construction(other.allocator_)) {
+    }
+
+    HashMap(const HashMap& other, const Allocator& allocator)
+        : hash_(other.hash_), allocator_(allocator) {
+        InitMemory(other.table_->capacity, other.table_->seed);
+        table_->sip_hashed = other.table_->sip_hashed;
         try {
-            pairs_ = new std::pair<KeyType, ValueType>[other.capacity_];
-            std::copy(other.pairs_, other.pairs_ + other.capacity_, pairs_);
-            used_ = new uint8_t[other.capacity_];
-            std::copy(other.used_, other.used_ + other.capacity_, used_);
+            CopyElements(other);
         } catch (...) {
-            delete[] pairs_;
-            delete[] used_;
+            ClearMemory();
             throw;
         }
     }
 
+    // The source is left empty with a table of its own, as after Clear().
     HashMap(HashMap&& other)
-        : hash_(other.hash_),
-          size_(other.size_),
-          capacity_(other.capacity_),
-          used_(other.used_),
-          pairs_(other.pairs_) {
-        other.used_ = nullptr;
-        other.pairs_ = nullptr;
+        : hash_(other.hash_), allocator_(std::move(other.allocator_)), table_(other.table_) {
+        other.InitMemory(kInitialSize, hash_mix::RandomSeed());
     }
 
     HashMap& operator=(const HashMap& other) {
@@ -55,14 +139,12 @@ public:
             return *this;
         }
         ClearMemory();
-        InitMemory(other.capacity_);
-
-        for (size_t i = 0; i < capacity_; i++) {
-            if (other.used_[i] == 1) {
-                CheckOverload();
-                CreatePair(i, other.pairs_[i].first, other.pairs_[i].second);
-            }
+        if constexpr (AllocatorTraits::propagate_on_container_copy_assignment::value) {
+            allocator_ = other.allocator_;
         }
+        InitMemory(other.table_->capacity, other.table_->seed);
+        table_->sip_hashed = other.table_->sip_hashed;
+        CopyElements(other);
         return *this;
     }
 
@@ -70,34 +152,87 @@ public:
         if (this == &other) {
             return *this;
         }
+        if constexpr (!AllocatorTraits::propagate_on_container_move_assignment::value) {
+            if (allocator_ != other.allocator_) {
+                ClearMemory();
+                InitMemory(other.table_->capacity, other.table_->seed);
+                table_->sip_hashed = other.table_->sip_hashed;
+                CopyElements(other);
+                hash_ = other.hash_;
+                other.Clear();
+                return *this;
+            }
+        }
+        // The source gets its empty table first, so that a failed allocation changes neither map.
+        Header* table = other.table_;
+        other.InitMemory(kInitialSize, hash_mix::RandomSeed());
         ClearMemory();
-        std::swap(used_, other.used_);
-        std::swap(pairs_, other.pairs_);
-        std::swap(size_, other.size_);
-        std::swap(capacity_, other.capacity_);
+        if constexpr (AllocatorTraits::propagate_on_container_move_assignment::value) {
+            allocator_ = std::move(other.allocator_);
+        }
+        table_ = table;
         std::swap(hash_, other.hash_);
         return *this;
     }
 
+    void Swap(HashMap& other) {
+        if constexpr (AllocatorTraits::propagate_on_container_swap::value) {
+            std::swap(allocator_, other.allocator_);
+        }
+        std::swap(table_, other.table_);
+        std::swap(hash_, other.hash_);
+    }
+
     ~HashMap() {
-        delete[] used_;
-        delete[] pairs_;
-        used_ = nullptr;
-        pairs_ = nullptr;
+        ClearMemory();
     }
 
     void Insert(const std::pair<KeyType, ValueType>& item) {
         CheckOverload();
-        size_t index = FindPosition(item.first);
-        if (used_[index] == 1) {
+        size_t probes;
+        size_t index = FindPosition(item.first, &probes);
+        if (Used(index) == 1) {
             return;
         }
+        if (CheckProbeLength(probes)) {
+            index = FindPosition(item.first);
+        }
         CreatePair(index, item.first, item.second);
     }
 
+    // Inserts a whole sized range, growing the table at most once up front; keys are hashed and
+    // their home groups prefetched a window ahead of the insertion.
+    template <std::ranges::forward_range Range>
+        requires std::ranges::sized_range<Range>
+    void InsertBatch(const Range& items) {
+        size_t count = std::ranges::size(items);
+        Reserve(table_->size + count);
+        if (kMaxPercent * (table_->size + table_->tombstones + count) >
+            kMaxLoadWithTombstones * table_->capacity) {
+            Rebuild(table_->capacity);
+        }
+        // A reseed moves every element, so the walk restarts after the item that caused it.
+        for (size_t done = 0; done < count;) {
+            done += ForEachPosition(
+                std::ranges::next(std::ranges::begin(items), done), count - done,
+                [](const auto& item) -> const KeyType& { return item.first; },
+                [&](size_t, const auto& item, size_t index, size_t probes) {
+                    if (Used(index) == 1) {
+                        return true;
+                    }
+                    if (CheckProbeLength(probes)) {
+                        CreatePair(FindPosition(item.first), item.first, item.second);
+                        return false;
+                    }
+                    CreatePair(index, item.first, item.second);
+                    return true;
+                });
+        }
+    }
+
     void Erase(const KeyType& key) {
         size_t index = FindPosition(key);
-        if (used_[index] != 1) {
+        if (Used(index) != 1) {
             return;
         }
         DeletePair(index);
@@ -105,294 +240,1083 @@ public:
     }
 
     ValueType& operator[](const KeyType& key) {
-        size_t index = FindPosition(key);
-        if (used_[index] != 1) {
+        size_t probes;
+        size_t index = FindPosition(key, &probes);
+        if (Used(index) != 1) {
             if (CheckOverload()) {
+                index = FindPosition(key, &probes);
+            }
+            if (CheckProbeLength(probes)) {
                 index = FindPosition(key);
             }
             CreatePair(index, key, ValueType{});
         }
-        return pairs_[index].second;
+        return Pair(index).second;
     };
 
     const ValueType& At(const KeyType& key) const {
         size_t index = FindPosition(key);
-        if (used_[index] != 1) {
+        if (Used(index) != 1) {
             throw std::out_of_range("The key doesn't exist");
         }
-        return pairs_[index].second;
+        return Pair(index).second;
     };
 
     size_t Size() const {
-        return size_;
+        return table_->size;
     }
 
     bool Empty() const {
-        return size_ == 0;
+        return table_->size == 0;
     }
 
     void Clear() {
         ClearMemory();
-        InitMemory(kInitialSize);
+        InitMemory(kInitialSize, hash_mix::RandomSeed());
+    }
+
+    void Reserve(size_t count) {
+        size_t capacity = table_->capacity;
+        while (kMaxPercent * count > kTopLoadFactor * capacity) {
+            capacity *= 2;
+        }
+        if (capacity != table_->capacity) {
+            Rebuild(capacity);
+        }
+    }
+
+    enum class DuplicatePolicy { kFirstWins, kLastWins };
+
+    // Builds a map from a random-access range on all hardware threads: keys are hashed in
+    // parallel, radix-partitioned by the region of the table their home group lies in, and each
+    // partition is inserted by one thread in source order, so duplicates resolve as policy says.
+    template <std::random_access_iterator Iterator>
+    static HashMap BulkBuild(Iterator begin, Iterator end,
+                             DuplicatePolicy policy = DuplicatePolicy::kFirstWins,
+                             Hash hash = Hash(), const Allocator& allocator = Allocator()) {
+        HashMap map(hash, allocator);
+        size_t count = end - begin;
+        map.Reserve(count);
+        size_t threads_count = kRebuildsInParallel && count >= kParallelBuildSize
+                                   ? hash_map_parallel::ThreadCount()
+                                   : 1;
+        if (threads_count > 1) {
+            map.BuildInParallel(begin, count, policy, threads_count);
+            return map;
+        }
+        for (auto it = begin; it != end; ++it) {
+            if (policy == DuplicatePolicy::kLastWins) {
+                map[(*it).first] = (*it).second;
+            } else {
+                map.Insert(*it);
+            }
+        }
+        return map;
+    }
+
+    // Copies the elements into a read-only FrozenMap whose minimal perfect hash gives every lookup
+    // exactly one slot to compare; building it takes a few passes over the elements. The snapshot
+    // hashes like this table, with SipHash if it has switched to it. Throws std::invalid_argument
+    // if two keys have equal hashes under the seed of this table.
+    FrozenMap<KeyType, ValueType, Hash, Allocator> Freeze() const {
+        return FrozenMap<KeyType, ValueType, Hash, Allocator>(begin(), end(), hash_, table_->seed,
+                                                              table_->sip_hashed, allocator_);
+    }
+
+    // Looks every element up again the way Find does and follows its probe sequence to the first
+    // group with an empty slot, so it takes a pass over the whole table.
+    HashMapStats Stats() const {
+        HashMapStats stats;
+        stats.size = table_->size;
+        stats.capacity = table_->capacity;
+        stats.tombstones = table_->tombstones;
+        size_t total_probes = 0, mask = table_->group_count - 1;
+        for (size_t index = 0; index < SlotCount(); ++index) {
+            if (Used(index) != 1) {
+                continue;
+            }
+            size_t hash = HashOf(Pair(index).first), shift_hash = ComputeShiftHash(hash);
+            size_t probes = 0;
+            FindPosition(Pair(index).first, hash & mask, shift_hash, &probes);
+            if (stats.probe_length_histogram.size() < probes) {
+                stats.probe_length_histogram.resize(probes);
+            }
+            ++stats.probe_length_histogram[probes - 1];
+            total_probes += probes;
+            stats.max_probe_length = std::max(stats.max_probe_length, probes);
+            size_t closed = 0;
+            for (size_t group = hash & mask; !HasEmptySlot(Groups()[group]);
+                 group = (group + shift_hash) & mask) {
+                ++closed;
+            }
+            stats.keys_in_long_clusters += closed >= HashMapStats::kLongClusterGroups;
+        }
+        if (stats.size != 0) {
+            stats.average_probe_length = static_cast<double>(total_probes) / stats.size;
+        }
+        return stats;
     }
 
     Hash HashFunction() const {
         return hash_;
     }
 
+    Allocator GetAllocator() const {
+        return allocator_;
+    }
+
     class iterator {  // NOLINT
     public:
-        iterator() : ptr_pair_(nullptr), ptr_used_(nullptr), end_used_(nullptr) {
+        iterator() : group_(nullptr), slot_(0), end_group_(nullptr) {
         }
-        iterator(std::pair<KeyType, ValueType>* ptr_pair, uint8_t* ptr_used, uint8_t* end_used)
-            : ptr_pair_(reinterpret_cast<std::pair<const KeyType, ValueType>*>(ptr_pair)),
-              ptr_used_(ptr_used),
-              end_used_(end_used) {
+        iterator(Group* group, size_t slot, Group* end_group)
+            : group_(group), slot_(slot), end_group_(end_group) {
         }
 
         std::pair<const KeyType, ValueType>& operator*() {
-            return *ptr_pair_;
+            return *operator->();
         }
 
         std::pair<const KeyType, ValueType>* operator->() {
-            return ptr_pair_;
+            return reinterpret_cast<std::pair<const KeyType, ValueType>*>(group_->Pairs() + slot_);
         }
 
         iterator& operator++() {
-            ++ptr_pair_;
-            while (++ptr_used_ != end_used_ && *(ptr_used_) != 1) {
-                ++ptr_pair_;
-            }
+            Advance(group_, slot_, end_group_);
             return *this;
         }
         iterator operator++(int) {
             iterator cur = *this;
-            ++ptr_pair_;
-            while (++ptr_used_ != end_used_ && *(ptr_used_) != 1) {
-                ++ptr_pair_;
-            }
+            Advance(group_, slot_, end_group_);
             return cur;
         }
 
         bool operator==(const iterator& other) const {
-            return ptr_used_ == other.ptr_used_ && ptr_pair_ == other.ptr_pair_;
+            return group_ == other.group_ && slot_ == other.slot_;
         }
 
         bool operator!=(const iterator& other) const {
-            return ptr_used_ != other.ptr_used_ || ptr_pair_ != other.ptr_pair_;
+            return group_ != other.group_ || slot_ != other.slot_;
         }
 
     private:
-        std::pair<const KeyType, ValueType>* ptr_pair_ = nullptr;
-        uint8_t *ptr_used_ = nullptr, *end_used_ = nullptr;
+        Group* group_ = nullptr;
+        size_t slot_ = 0;
+        Group* end_group_ = nullptr;
     };
 
     class const_iterator {  // NOLINT
     public:
-        const_iterator() : ptr_pair_(nullptr), ptr_used_(nullptr), end_used_(nullptr) {
+        const_iterator() : group_(nullptr), slot_(0), end_group_(nullptr) {
         }
-        const_iterator(const std::pair<KeyType, ValueType>* ptr_pair, uint8_t* ptr_used,
-                       uint8_t* end_used)
-            : ptr_pair_(ptr_pair), ptr_used_(ptr_used), end_used_(end_used) {
+        const_iterator(const Group* group, size_t slot, const Group* end_group)
+            : group_(group), slot_(slot), end_group_(end_group) {
         }
 
         const std::pair<KeyType, ValueType>& operator*() {
-            return *ptr_pair_;
+            return group_->Pairs()[slot_];
         }
 
         const std::pair<KeyType, ValueType>* operator->() {
-            return ptr_pair_;
+            return group_->Pairs() + slot_;
         }
 
         const_iterator& operator++() {
-            ++ptr_pair_;
-            while ((++ptr_used_) != end_used_ && *ptr_used_ != 1) {
-                ++ptr_pair_;
-            }
+            Advance(group_, slot_, end_group_);
             return *this;
         }
         const_iterator operator++(int) {
             const_iterator cur = *this;
-            ++ptr_pair_;
-            while ((++ptr_used_) != end_used_ && *ptr_used_ != 1) {
-                ++ptr_pair_;
-            }
+            Advance(group_, slot_, end_group_);
             return cur;
         }
 
         bool operator==(const const_iterator& other) const {
-            return ptr_used_ == other.ptr_used_ && ptr_pair_ == other.ptr_pair_;
+            return group_ == other.group_ && slot_ == other.slot_;
         }
 
         bool operator!=(const const_iterator& other) const {
-            return ptr_used_ != other.ptr_used_ || ptr_pair_ != other.ptr_pair_;
+            return group_ != other.group_ || slot_ != other.slot_;
         }
 
     private:
-        const std::pair<KeyType, ValueType>* ptr_pair_ = nullptr;
-        uint8_t *ptr_used_ = nullptr, *end_used_ = nullptr;
+        const Group* group_ = nullptr;
+        size_t slot_ = 0;
+        const Group* end_group_ = nullptr;
     };
 
     iterator begin() {  // NOLINT
-        uint8_t* begin = used_;
-        while (begin != used_ + capacity_ && *(begin) != 1) {
-            ++begin;
-        }
-        return iterator(pairs_ + (begin - used_), begin, used_ + capacity_);
+        return IteratorAt<iterator>(FirstUsed());
     }
     iterator end() {  // NOLINT
-        return iterator(pairs_ + capacity_, used_ + capacity_, used_ + capacity_);
+        return IteratorAt<iterator>(SlotCount());
     }
 
     const_iterator begin() const {  // NOLINT
-        uint8_t* begin = used_;
-        while (begin != used_ + capacity_ && *(begin) != 1) {
-            ++begin;
-        }
-        return const_iterator(pairs_ + (begin - used_), begin, used_ + capacity_);
+        return IteratorAt<const_iterator>(FirstUsed());
     }
     const_iterator end() const {  // NOLINT
-        return const_iterator(pairs_ + capacity_, used_ + capacity_, used_ + capacity_);
+        return IteratorAt<const_iterator>(SlotCount());
     }
 
     const_iterator Find(const KeyType& key) const {
         size_t index = FindPosition(key);
-        if (used_[index] != 1) {
+        if (Used(index) != 1) {
             return end();
         }
-        return const_iterator(pairs_ + index, used_ + index, used_ + capacity_);
+        return IteratorAt<const_iterator>(index);
     }
 
     iterator Find(const KeyType& key) {
         size_t index = FindPosition(key);
-        if (used_[index] != 1) {
+        if (Used(index) != 1) {
             return end();
         }
-        return iterator(pairs_ + index, used_ + index, used_ + capacity_);
+        return IteratorAt<iterator>(index);
+    }
+
+    // Looks up keys[i] into out[i]. The home groups of the next kPrefetchWindow keys are
+    // prefetched while the current one is probed, so independent cache misses overlap.
+    void FindBatch(std::span<const KeyType> keys, std::span<iterator> out) {
+        FindBatchImpl(keys, out);
+    }
+
+    void FindBatch(std::span<const KeyType> keys, std::span<const_iterator> out) const {
+        FindBatchImpl(keys, out);
+    }
+
+    // Like FindBatch, but every lookup runs as one of kInFlightLookups coroutines that prefetch
+    // the next group of their probe chain and suspend, so collision chains of any length overlap
+    // their misses too.
+    void FindInterleaved(std::span<const KeyType> keys, std::span<iterator> out) {
+        FindInterleavedImpl(keys, out);
     }
 
+    void FindInterleaved(std::span<const KeyType> keys, std::span<const_iterator> out) const {
+        FindInterleavedImpl(keys, out);
+    }
+
+    void ContainsBatch(std::span<const KeyType> keys, std::span<bool> out) const {
+        CheckBatchSize(keys.size(), out.size());
+        ForEachPosition(keys.begin(), keys.size(), std::identity(),
+                        [&](size_t i, const KeyType&, size_t index, size_t) {
+                            out[i] = Used(index) == 1;
+                            return true;
+                        });
+    }
+
+    // Fills a table reserved for expected_size elements from many threads at once and turns it
+    // into an ordinary HashMap without copying. Only Insert may be called concurrently; a key
+    // that is already present keeps its value.
+    class ConcurrentBuilder {
+    public:
+        explicit ConcurrentBuilder(size_t expected_size, Hash hash = Hash(),
+                                   const Allocator& allocator = Allocator())
+            : map_(hash, allocator) {
+            map_.Reserve(expected_size);
+            max_size_ = kTopLoadFactor * map_.table_->capacity / kMaxPercent;
+        }
+
+        bool Insert(const std::pair<KeyType, ValueType>& item) {
+            if (size_.fetch_add(1) >= max_size_) {
+                size_.fetch_sub(1);
+                throw std::length_error("The builder is full");
+            }
+            try {
+                if (map_.ConcurrentInsert(map_.HashOf(item.first), item.first, item.second)) {
+                    return true;
+                }
+            } catch (...) {
+                size_.fetch_sub(1);
+                throw;
+            }
+            size_.fetch_sub(1);
+            return false;
+        }
+
+        HashMap Seal() && {
+            map_.table_->size = size_.load();
+            return std::move(map_);
+        }
+
+    private:
+        HashMap map_;
+        size_t max_size_;
+        std::atomic<size_t> size_ = 0;
+    };
+
 private:
+    constexpr static const size_t kCacheLine = 64;
+    constexpr static const size_t kMaxGroupSize = 16;
+    // Slots are packed into cache-line-aligned groups together with their control bytes, and a
+    // probe scans a whole group before jumping, so most lookups touch a single cache line.
+    constexpr static const size_t kGroupSize =
+        std::clamp<size_t>(kCacheLine / (sizeof(std::pair<KeyType, ValueType>) + 1), 1,
+                           kMaxGroupSize);
+    constexpr static const size_t kNoPosition = static_cast<size_t>(-1);
     constexpr static const size_t kInitialSize = 2;
     constexpr static const size_t kShiftHashFactors[] = {239, 179, 191};
     constexpr static const size_t kBottomLoadFactor = 25;
     constexpr static const size_t kTopLoadFactor = 50;
     constexpr static const size_t kMaxPercent = 100;
+
+    constexpr static const size_t kMaxLoadWithTombstones = 75;
+    // Old tables with at least this many slots are reinserted by all hardware threads at once.
+    constexpr static const size_t kParallelRebuildSlots = size_t{1} << 22;
+    constexpr static const size_t kParallelBuildSize = size_t{1} << 16;
+    constexpr static const size_t kPartitionsPerThread = 4;
+    constexpr static const size_t kPrefetchWindow = 16;
+    constexpr static const size_t kInFlightLookups = 16;
+    // An insertion may scan this many groups per bit of the group count before the table is
+    // taken to be flooded with colliding keys.
+    constexpr static const size_t kProbeLimitPerBit = 4;
+    using AppliedMix = std::conditional_t<is_avalanching_v<Hash>, hash_mix::Identity, Mix>;
+    // Hash functions callable as hash(key, seed) take the seed of the table as a key.
+    constexpr static const bool kSeededHash =
+        std::is_invocable_v<const Hash&, const KeyType&, uint64_t>;
+    constexpr static const bool kNothrowHash =
+        (kSeededHash ? std::is_nothrow_invocable_v<const Hash&, const KeyType&, uint64_t>
+                     : std::is_nothrow_invocable_v<const Hash&, const KeyType&>) &&
+        std::is_nothrow_invocable_v<AppliedMix, uint64_t>;
+    // Tables whose keys keep colliding under a fresh seed switch to SipHash if it takes the keys,
+    // i.e. for strings and integers, whose equality is that of their bytes.
+    constexpr static const bool kSipHashFallback =
+        std::is_invocable_v<const SipHash&, const KeyType&, uint64_t> &&
+        !std::is_same_v<Hash, SipHash>;
+    // std::hash is the identity on integers, so their batched probe starts can be vectorized
+    // together with the finalizer.
+    constexpr static const bool kVectorHash =
+        probe_kernels::kVectorizable<KeyType> && std::is_same_v<Hash, std::hash<KeyType>> &&
+        probe_kernels::kVectorizableMix<hash_mix::SeedMix<AppliedMix>>;
+    // Control byte of a slot claimed by a concurrent insertion whose pair is still being written.
+    constexpr static const uint8_t kBusy = 4;
+
+    // Pairs are constructed in place through the allocator, so a group only reserves their
+    // storage.
+    struct alignas(kCacheLine) Group {
+        uint8_t used[kGroupSize];
+        alignas(std::pair<KeyType, ValueType>) unsigned char
+            storage[kGroupSize * sizeof(std::pair<KeyType, ValueType>)];
+
+        std::pair<KeyType, ValueType>* Pairs() {
+            return std::launder(reinterpret_cast<std::pair<KeyType, ValueType>*>(storage));
+        }
+
+        const std::pair<KeyType, ValueType>* Pairs() const {
+            return std::launder(reinterpret_cast<const std::pair<KeyType, ValueType>*>(storage));
+        }
+    };
+
+    // The whole table is one cache-line-aligned block: this header followed by the groups. The
+    // seed is drawn at random for every new map, so an attacker who knows the hash function still
+    // cannot predict which keys collide; it is part of the table because the layout depends on it.
+    struct alignas(kCacheLine) Header {
+        size_t capacity;
+        size_t size;
+        size_t tombstones;
+        size_t group_count;
+        uint64_t seed;
+        // Set once the table has been rebuilt under a new seed because of a long probe chain.
+        bool reseeded;
+        // Set once the keys have been found to collide under every seed of Hash; from then on
+        // they are hashed with SipHash.
+        bool sip_hashed;
+    };
+
+    struct alignas(kCacheLine) Block {
+        unsigned char bytes[kCacheLine];
+    };
+
+    using BlockAllocator = typename AllocatorTraits::template rebind_alloc<Block>;
+    using BlockTraits = std::allocator_traits<BlockAllocator>;
+    using PairAllocator =
+        typename AllocatorTraits::template rebind_alloc<std::pair<KeyType, ValueType>>;
+    using PairTraits = std::allocator_traits<PairAllocator>;
+
+    // Tables of trivially copyable pairs may be grown by an allocator that can extend a block
+    // in place (e.g. with mremap), followed by an in-place redistribution pass.
+    constexpr static const bool kGrowsInPlace =
+        std::is_trivially_copyable_v<KeyType> && std::is_trivially_copyable_v<ValueType> &&
+        kNothrowHash &&
+        requires(BlockAllocator& allocator, Block* blocks, size_t count) {
+            { allocator.Reallocate(blocks, count, count) } -> std::same_as<Block*>;
+        };
+
+    // Parallel reinsertion claims slots like ConcurrentInsert and cannot undo a half-filled
+    // table, so copying an element must not throw.
+    constexpr static const bool kRebuildsInParallel =
+        std::is_nothrow_copy_assignable_v<KeyType> &&
+        std::is_nothrow_copy_assignable_v<ValueType> &&
+        kNothrowHash;
+
     Hash hash_;
-    std::pair<KeyType, ValueType>* pairs_ = nullptr;
-    size_t size_;
-    size_t capacity_;
-    uint8_t* used_ = nullptr;
-    void InitMemory(size_t new_capacity) {
+    [[no_unique_address]] Allocator allocator_;
+    Header* table_ = nullptr;
+
+    template <class GroupPointer>
+    static void Advance(GroupPointer& group, size_t& slot, GroupPointer end_group) {
+        do {
+            if (++slot == kGroupSize) {
+                slot = 0;
+                ++group;
+            }
+        } while (group != end_group && group->used[slot] != 1);
+    }
+
+    static size_t BlockCount(size_t group_count) {
+        return (sizeof(Header) + group_count * sizeof(Group)) / sizeof(Block);
+    }
+
+    Header* AllocateTable(size_t group_count, uint64_t seed) {
+        BlockAllocator block_allocator(allocator_);
+        Block* blocks = BlockTraits::allocate(block_allocator, BlockCount(group_count));
+        Header* table = new (blocks) Header{0, 0, 0, group_count, seed, false, false};
+        Group* groups = reinterpret_cast<Group*>(table + 1);
+        for (size_t i = 0; i < group_count; ++i) {
+            std::fill_n(groups[i].used, kGroupSize, 0);
+        }
+        return table;
+    }
+
+    void DeallocateTable(Header* table) {
+        BlockAllocator block_allocator(allocator_);
+        BlockTraits::deallocate(block_allocator, reinterpret_cast<Block*>(table),
+                                BlockCount(table->group_count));
+    }
+
+    void DestroyPairs(Header* table, size_t count) {
+        PairAllocator pair_allocator(allocator_);
+        Group* groups = reinterpret_cast<Group*>(table + 1);
+        for (size_t i = 0; i < count; ++i) {
+            PairTraits::destroy(pair_allocator, groups[i / kGroupSize].Pairs() + i % kGroupSize);
+        }
+    }
+
+    void DestroyTable(Header* table) {
+        if (table == nullptr) {
+            return;
+        }
+        DestroyPairs(table, table->group_count * kGroupSize);
+        DeallocateTable(table);
+    }
+
+    void InitMemory(size_t new_capacity, uint64_t seed) {
+        size_t group_count = 1;
+        while (group_count * kGroupSize < new_capacity) {
+            group_count *= 2;
+        }
+        Header* table = AllocateTable(group_count, seed);
+        PairAllocator pair_allocator(allocator_);
+        Group* groups = reinterpret_cast<Group*>(table + 1);
+        size_t constructed = 0;
         try {
-            pairs_ = new std::pair<KeyType, ValueType>[new_capacity];
-            size_ = 0;
-            capacity_ = new_capacity;
-            used_ = new uint8_t[new_capacity];
+            for (; constructed < group_count * kGroupSize; ++constructed) {
+                PairTraits::construct(pair_allocator, groups[constructed / kGroupSize].Pairs() +
+                                                          constructed % kGroupSize);
+            }
         } catch (...) {
-            delete[] pairs_;
+            DestroyPairs(table, constructed);
+            DeallocateTable(table);
             throw;
         }
-        for (size_t i = 0; i < capacity_; i++) {
-            used_[i] = 0;
-        }
+        table_ = table;
+        // A lone group is filled only up to the requested capacity, so small maps still grow
+        // at the same sizes as before.
+        table_->capacity =
+            group_count == 1 ? std::min(new_capacity, kGroupSize) : group_count * kGroupSize;
     }
 
     void ClearMemory() {
-        delete[] used_;
-        delete[] pairs_;
-        used_ = nullptr;
-        pairs_ = nullptr;
+        DestroyTable(table_);
+        table_ = nullptr;
+    }
+
+    // Keeps every element at the same index as in other, so tombstones are copied too: they may
+    // sit in front of an element on its probe sequence.
+    void CopyElements(const HashMap& other) {
+        for (size_t i = 0; i < SlotCount(); i++) {
+            if (other.Used(i) == 1) {
+                CreatePair(i, other.Pair(i).first, other.Pair(i).second);
+            } else if (other.Used(i) == 2) {
+                Used(i) = 2;
+                table_->tombstones++;
+            }
+        }
+    }
+
+    Group* Groups() const {
+        return reinterpret_cast<Group*>(table_ + 1);
+    }
+
+    uint8_t& Used(size_t index) const {
+        return Groups()[index / kGroupSize].used[index % kGroupSize];
+    }
+
+    std::pair<KeyType, ValueType>& Pair(size_t index) const {
+        return Groups()[index / kGroupSize].Pairs()[index % kGroupSize];
+    }
+
+    size_t SlotCount() const {
+        return table_->group_count * kGroupSize;
+    }
+
+    // A probe sequence ends at the first group with an empty slot.
+    static bool HasEmptySlot(const Group& group) {
+        return std::find(group.used, group.used + kGroupSize, 0) != group.used + kGroupSize;
+    }
+
+    size_t FirstUsed() const {
+        size_t index = 0;
+        while (index != SlotCount() && Used(index) != 1) {
+            ++index;
+        }
+        return index;
+    }
+
+    // A lookup coroutine that starts suspended and is resumed by FindInterleavedImpl until done.
+    class LookupCoroutine {
+    public:
+        struct promise_type {
+            std::exception_ptr exception;
+
+            LookupCoroutine get_return_object() {  // NOLINT
+                return LookupCoroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() noexcept {  // NOLINT
+                return {};
+            }
+            std::suspend_always final_suspend() noexcept {  // NOLINT
+                return {};
+            }
+            void return_void() {  // NOLINT
+            }
+            void unhandled_exception() {  // NOLINT
+                exception = std::current_exception();
+            }
+        };
+
+        LookupCoroutine() = default;
+
+        LookupCoroutine(LookupCoroutine&& other) : handle_(std::exchange(other.handle_, {})) {
+        }
+
+        LookupCoroutine& operator=(LookupCoroutine&& other) {
+            std::swap(handle_, other.handle_);
+            return *this;
+        }
+
+        ~LookupCoroutine() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        bool Done() const {
+            return handle_.done();
+        }
+
+        void Resume() {
+            handle_.resume();
+            if (handle_.done() && handle_.promise().exception) {
+                std::rethrow_exception(handle_.promise().exception);
+            }
+        }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+
+        explicit LookupCoroutine(std::coroutine_handle<promise_type> handle) : handle_(handle) {
+        }
+    };
+
+    // Resolves keys first, first + stride, ... and suspends after prefetching every group it is
+    // about to scan.
+    template <class Iterator>
+    LookupCoroutine LookupStrided(std::span<const KeyType> keys, std::span<Iterator> out,
+                                  size_t first, size_t stride) const {
+        for (size_t i = first; i < keys.size(); i += stride) {
+            size_t hash = HashOf(keys[i]), shift_hash = ComputeShiftHash(hash);
+            size_t group = hash & (table_->group_count - 1);
+            size_t index = kNoPosition;
+            while (index == kNoPosition) {
+                __builtin_prefetch(Groups() + group);
+                co_await std::suspend_always();
+                const Group& current = Groups()[group];
+                for (size_t slot = 0; slot < kGroupSize && index == kNoPosition; ++slot) {
+                    if (current.used[slot] == 1 && current.Pairs()[slot].first == keys[i]) {
+                        index = group * kGroupSize + slot;
+                    } else if (current.used[slot] == 0) {
+                        index = SlotCount();
+                    }
+                }
+                group = (group + shift_hash) & (table_->group_count - 1);
+            }
+            out[i] = IteratorAt<Iterator>(index);
+        }
+    }
+
+    template <class Iterator>
+    void FindInterleavedImpl(std::span<const KeyType> keys, std::span<Iterator> out) const {
+        CheckBatchSize(keys.size(), out.size());
+        size_t count = std::min(keys.size(), kInFlightLookups), active = count;
+        LookupCoroutine lookups[kInFlightLookups];
+        for (size_t i = 0; i < count; ++i) {
+            lookups[i] = LookupStrided(keys, out, i, count);
+        }
+        while (active != 0) {
+            for (size_t i = 0; i < count; ++i) {
+                if (!lookups[i].Done()) {
+                    lookups[i].Resume();
+                    active -= lookups[i].Done();
+                }
+            }
+        }
+    }
+
+    template <class Iterator>
+    void FindBatchImpl(std::span<const KeyType> keys, std::span<Iterator> out) const {
+        CheckBatchSize(keys.size(), out.size());
+        ForEachPosition(keys.begin(), keys.size(), std::identity(),
+                        [&](size_t i, const KeyType&, size_t index, size_t) {
+                            out[i] = IteratorAt<Iterator>(Used(index) == 1 ? index : SlotCount());
+                            return true;
+                        });
+    }
+
+    static void CheckBatchSize(size_t keys_size, size_t out_size) {
+        if (out_size < keys_size) {
+            throw std::invalid_argument("The output span is shorter than the keys");
+        }
+    }
+
+    // Calls callback(i, element, position, probes), where position is FindPosition(key_of(element))
+    // and probes the number of groups it scanned, for the count elements from first on, in order,
+    // until the callback returns false; returns the number of calls. Probe starts are computed a
+    // block of kPrefetchWindow elements at a time and the home groups of the next block are
+    // prefetched while the current one is resolved.
+    template <class Iterator, class Projection, class Callback>
+    size_t ForEachPosition(Iterator first, size_t count, Projection key_of,
+                           Callback callback) const {
+        size_t groups[2][kPrefetchWindow], strides[2][kPrefetchWindow];
+        Iterator ahead = first;
+        auto prepare = [&](size_t block) {
+            size_t size = std::min(kPrefetchWindow, count - block * kPrefetchWindow);
+            ComputeProbeStarts(ahead, size, key_of, groups[block % 2], strides[block % 2]);
+            for (size_t j = 0; j < size; ++j) {
+                __builtin_prefetch(Groups() + groups[block % 2][j]);
+            }
+        };
+        size_t blocks = (count + kPrefetchWindow - 1) / kPrefetchWindow;
+        if (blocks != 0) {
+            prepare(0);
+        }
+        for (size_t block = 0, i = 0; block < blocks; ++block) {
+            if (block + 1 < blocks) {
+                prepare(block + 1);
+            }
+            const size_t *block_groups = groups[block % 2], *block_strides = strides[block % 2];
+            for (size_t j = 0; j < kPrefetchWindow && i < count; ++i, ++j, ++first) {
+                size_t probes;
+                size_t index =
+                    FindPosition(key_of(*first), block_groups[j], block_strides[j], &probes);
+                if (!callback(i, *first, index, probes)) {
+                    return i + 1;
+                }
+            }
+        }
+        return count;
+    }
+
+    // Integral keys under the identity std::hash go through the SIMD kernels, everything else
+    // through HashOf and ComputeShiftHash.
+    template <class Iterator, class Projection>
+    void ComputeProbeStarts(Iterator& ahead, size_t size, Projection key_of, size_t* groups,
+                            size_t* strides) const {
+        size_t mask = table_->group_count - 1;
+        if constexpr (kVectorHash) {
+            if (mask <= UINT32_MAX && !table_->sip_hashed) {
+                const KeyType* keys;
+                KeyType gathered[kPrefetchWindow] = {};
+                if constexpr (std::contiguous_iterator<Iterator> &&
+                              std::is_same_v<Projection, std::identity>) {
+                    keys = std::to_address(ahead);
+                    ahead += size;
+                } else {
+                    for (size_t j = 0; j < size; ++j) {
+                        gathered[j] = key_of(*ahead++);
+                    }
+                    keys = gathered;
+                }
+                probe_kernels::ProbeStarts<KeyType, hash_mix::SeedMix<AppliedMix>>(
+                    keys, size, static_cast<uint32_t>(mask), table_->seed, kShiftHashFactors,
+                    groups, strides);
+                return;
+            }
+        }
+        for (size_t j = 0; j < size; ++j) {
+            size_t hash = HashOf(key_of(*ahead++));
+            groups[j] = hash & mask;
+            strides[j] = ComputeShiftHash(hash);
+        }
+    }
+
+    template <class Iterator>
+    Iterator IteratorAt(size_t index) const {
+        return Iterator(Groups() + index / kGroupSize, index % kGroupSize,
+                        Groups() + table_->group_count);
     }
 
     size_t ComputeShiftHash(size_t primary_hash) const {
         size_t res = 0;
         for (size_t rate : kShiftHashFactors) {
-            res = (res * primary_hash + rate) % capacity_;
+            res = (res * primary_hash + rate) & (table_->group_count - 1);
         }
-        return res;
+        return res | 1;
     }
 
-    size_t FindPosition(const KeyType& key) const {
-        size_t hash = hash_(key), shift_hash = ComputeShiftHash(hash);
-        size_t index = hash % capacity_;
-        size_t first_zero = capacity_;
-        while (used_[index] == 2 || (used_[index] == 1 && (pairs_[index].first != key))) {
-            if (first_zero == capacity_ && used_[index] == 2) {
-                first_zero = index;
+    size_t HashOf(const KeyType& key) const {
+        if constexpr (kSipHashFallback) {
+            if (table_->sip_hashed) [[unlikely]] {
+                return SipHash()(key, table_->seed);
             }
-            index = (index + shift_hash) % capacity_;
         }
-        if (used_[index] == 1 || pairs_[index].first == key) {
-            return index;
+        return static_cast<size_t>(hash_mix::SeededHash<AppliedMix>(hash_, key, table_->seed));
+    }
+
+    size_t FindPosition(const KeyType& key, size_t* probes = nullptr) const {
+        size_t hash = HashOf(key);
+        return FindPosition(key, hash & (table_->group_count - 1), ComputeShiftHash(hash), probes);
+    }
+
+    // Stores the number of groups scanned in probes, if given.
+    size_t FindPosition(const KeyType& key, size_t group, size_t shift_hash,
+                        size_t* probes = nullptr) const {
+        size_t first_deleted = kNoPosition;
+        for (size_t scanned = 1;; ++scanned) {
+            const Group& current = Groups()[group];
+            for (size_t slot = 0; slot < kGroupSize; ++slot) {
+                if (current.used[slot] == 1 && current.Pairs()[slot].first == key) {
+                    if (probes != nullptr) {
+                        *probes = scanned;
+                    }
+                    return group * kGroupSize + slot;
+                }
+                if (current.used[slot] == 2 && first_deleted == kNoPosition) {
+                    first_deleted = group * kGroupSize + slot;
+                }
+                if (current.used[slot] == 0) {
+                    if (probes != nullptr) {
+                        *probes = scanned;
+                    }
+                    return first_deleted != kNoPosition ? first_deleted
+                                                        : group * kGroupSize + slot;
+                }
+            }
+            group = (group + shift_hash) & (table_->group_count - 1);
         }
-        if (first_zero != capacity_) {
-            return first_zero;
+    }
+
+    size_t ProbeLimit() const {
+        return kProbeLimitPerBit * std::bit_width(table_->group_count);
+    }
+
+    // An insertion that scanned more than ProbeLimit() groups means the keys collide far more
+    // often than under a random hash, most likely on purpose, so the table is rebuilt under a
+    // fresh seed. Keys whose hashes collide before the seed is applied keep colliding, so a table
+    // is reseeded at most once until it is resized; a chain that is still too long after that
+    // switches the table to SipHash, for good.
+    bool CheckProbeLength(size_t probes) {
+        if (probes <= ProbeLimit()) {
+            return false;
         }
-        return index;
+        if (!table_->reseeded) {
+            Rebuild(table_->capacity, hash_mix::RandomSeed(), table_->sip_hashed);
+            table_->reseeded = true;
+            return true;
+        }
+        if constexpr (kSipHashFallback) {
+            if (!table_->sip_hashed) {
+                Rebuild(table_->capacity, hash_mix::RandomSeed(), true);
+                table_->reseeded = true;
+                return true;
+            }
+        }
+        return false;
     }
 
     void CreatePair(size_t index, const KeyType& key, const ValueType& value = ValueType()) {
-        pairs_[index].first = key;
-        pairs_[index].second = value;
-        size_++;
-        used_[index] = 1;
+        Pair(index).first = key;
+        Pair(index).second = value;
+        table_->size++;
+        if (Used(index) == 2) {
+            table_->tombstones--;
+        }
+        Used(index) = 1;
     }
 
     void DeletePair(size_t index) {
-        pairs_[index] = {KeyType{}, ValueType{}};
-        size_--;
-        used_[index] = 2;
+        Pair(index) = {KeyType{}, ValueType{}};
+        table_->size--;
+        table_->tombstones++;
+        Used(index) = 2;
     }
 
     bool CheckOverload() {
-        if (kMaxPercent * (size_ + 1) > kTopLoadFactor * capacity_) {
-            Rebuild(capacity_ * 2);
+        size_t size = table_->size, capacity = table_->capacity;
+        if (kMaxPercent * (size + 1) > kTopLoadFactor * capacity) {
+            Rebuild(capacity * 2);
+            return true;
+        }
+        if (kMaxPercent * (size + table_->tombstones + 1) > kMaxLoadWithTombstones * capacity) {
+            Rebuild(capacity);
             return true;
         }
         return false;
     }
 
     void CheckInsufficientLoad() {
-        if (size_ >= 2 * kInitialSize && kMaxPercent * size_ < kBottomLoadFactor * capacity_) {
-            Rebuild(capacity_ / 2);
+        size_t size = table_->size, capacity = table_->capacity;
+        if (size >= 2 * kInitialSize && kMaxPercent * size < kBottomLoadFactor * capacity) {
+            Rebuild(capacity / 2);
         }
     }
 
     void Rebuild(size_t new_capacity) {
-        size_t new_size = 0;
-        uint8_t* new_used = new uint8_t[new_capacity];
-        for (size_t i = 0; i < new_capacity; i++) {
-            new_used[i] = 0;
+        Rebuild(new_capacity, table_->seed, table_->sip_hashed);
+    }
+
+    void Rebuild(size_t new_capacity, uint64_t seed, bool sip_hashed) {
+        if constexpr (kGrowsInPlace) {
+            if (new_capacity > SlotCount() && seed == table_->seed &&
+                sip_hashed == table_->sip_hashed && GrowInPlace(new_capacity)) {
+                return;
+            }
         }
-        std::pair<KeyType, ValueType>* new_pairs;
+        Header* old_table = table_;
+        Group* old_groups = Groups();
         try {
-            new_pairs = new std::pair<KeyType, ValueType>[new_capacity];
+            InitMemory(new_capacity, seed);
+            table_->sip_hashed = sip_hashed;
+            table_->reseeded =
+                old_table->reseeded && table_->group_count == old_table->group_count;
+            size_t old_slots = old_table->group_count * kGroupSize;
+            size_t threads_count = kRebuildsInParallel && old_slots >= kParallelRebuildSlots
+                                       ? hash_map_parallel::ThreadCount()
+                                       : 1;
+            if (threads_count > 1) {
+                ReinsertInParallel(old_groups, old_table->group_count, threads_count);
+                table_->size = old_table->size;
+            } else {
+                for (size_t i = 0; i < old_slots; i++) {
+                    const Group& group = old_groups[i / kGroupSize];
+                    if (group.used[i % kGroupSize] == 1) {
+                        const std::pair<KeyType, ValueType>& item = group.Pairs()[i % kGroupSize];
+                        CreatePair(FindPosition(item.first), item.first, item.second);
+                    }
+                }
+            }
         } catch (...) {
-            delete[] new_used;
+            if (table_ != old_table) {
+                ClearMemory();
+            }
+            table_ = old_table;
             throw;
         }
+        DestroyTable(old_table);
+    }
 
-        std::swap(new_capacity, capacity_);
-        std::swap(new_size, size_);
-        std::swap(new_used, used_);
-        std::swap(new_pairs, pairs_);
-        try {
-            for (size_t i = 0; i < new_capacity; i++) {
-                if (new_used[i] == 1) {
-                    size_t index = FindPosition(new_pairs[i].first);
-                    CreatePair(index, new_pairs[i].first, new_pairs[i].second);
+    template <class Function>
+    static void RunOnThreads(size_t threads_count, Function function) {
+        std::vector<std::jthread> threads;
+        threads.reserve(threads_count);
+        for (size_t thread = 0; thread < threads_count; ++thread) {
+            threads.emplace_back(function, thread);
+        }
+    }
+
+    // Splits the old groups into one contiguous range per thread; the keys are distinct, so every
+    // ConcurrentInsert succeeds and only the slot claims have to be synchronized.
+    void ReinsertInParallel(const Group* groups, size_t group_count, size_t threads_count) {
+        threads_count = std::min(threads_count, group_count);
+        RunOnThreads(threads_count, [&](size_t thread) {
+            size_t begin = group_count * thread / threads_count;
+            size_t end = group_count * (thread + 1) / threads_count;
+            for (size_t i = begin * kGroupSize; i < end * kGroupSize; i++) {
+                const Group& group = groups[i / kGroupSize];
+                if (group.used[i % kGroupSize] == 1) {
+                    const std::pair<KeyType, ValueType>& item = group.Pairs()[i % kGroupSize];
+                    ConcurrentInsert(HashOf(item.first), item.first, item.second);
                 }
             }
-        } catch (...) {
-            std::swap(new_capacity, capacity_);
-            std::swap(new_size, size_);
-            std::swap(new_used, used_);
-            std::swap(new_pairs, pairs_);
-            delete[] new_used;
-            delete[] new_pairs;
-            throw;
+        });
+    }
+
+    // All copies of a key share a hash and hence a partition, and a partition is inserted by a
+    // single thread in source order; that is what makes overwriting an existing value safe.
+    template <class Iterator>
+    void BuildInParallel(Iterator begin, size_t count, DuplicatePolicy policy,
+                         size_t threads_count) {
+        size_t group_bits = std::bit_width(table_->group_count) - 1;
+        size_t partition_bits =
+            std::min<size_t>(std::bit_width(threads_count * kPartitionsPerThread - 1), group_bits);
+        size_t partitions = size_t{1} << partition_bits;
+        auto partition_of = [&](size_t hash) {
+            return (hash & (table_->group_count - 1)) >> (group_bits - partition_bits);
+        };
+        auto chunk = [&](size_t thread) {
+            return std::pair(count * thread / threads_count, count * (thread + 1) / threads_count);
+        };
+
+        std::vector<size_t> hashes(count), order(count), offsets(threads_count * partitions);
+        RunOnThreads(threads_count, [&](size_t thread) {
+            auto [first, last] = chunk(thread);
+            for (size_t i = first; i < last; ++i) {
+                hashes[i] = HashOf(begin[i].first);
+                ++offsets[thread * partitions + partition_of(hashes[i])];
+            }
+        });
+        // Partition-major, thread-minor prefix sums keep every partition in source order.
+        std::vector<size_t> partition_begin(partitions + 1);
+        for (size_t partition = 0, offset = 0; partition < partitions; ++partition) {
+            partition_begin[partition] = offset;
+            for (size_t thread = 0; thread < threads_count; ++thread) {
+                offset += std::exchange(offsets[thread * partitions + partition], offset);
+            }
+        }
+        partition_begin[partitions] = count;
+        RunOnThreads(threads_count, [&](size_t thread) {
+            auto [first, last] = chunk(thread);
+            for (size_t i = first; i < last; ++i) {
+                order[offsets[thread * partitions + partition_of(hashes[i])]++] = i;
+            }
+        });
+
+        std::atomic<size_t> next_partition = 0, size = 0;
+        RunOnThreads(threads_count, [&](size_t) {
+            size_t inserted = 0, partition;
+            while ((partition = next_partition.fetch_add(1)) < partitions) {
+                for (size_t j = partition_begin[partition]; j < partition_begin[partition + 1];
+                     ++j) {
+                    const auto& item = begin[order[j]];
+                    inserted += ConcurrentInsert(hashes[order[j]], item.first, item.second,
+                                                 policy == DuplicatePolicy::kLastWins);
+                }
+            }
+            size += inserted;
+        });
+        table_->size = size;
+    }
+
+    bool GrowInPlace(size_t new_capacity) {
+        size_t group_count = table_->group_count;
+        while (group_count * kGroupSize < new_capacity) {
+            group_count *= 2;
+        }
+        BlockAllocator block_allocator(allocator_);
+        Block* blocks = block_allocator.Reallocate(reinterpret_cast<Block*>(table_),
+                                                   BlockCount(table_->group_count),
+                                                   BlockCount(group_count));
+        if (blocks == nullptr) {
+            return false;
+        }
+        table_ = reinterpret_cast<Header*>(blocks);
+        PairAllocator pair_allocator(allocator_);
+        for (size_t i = table_->group_count; i < group_count; ++i) {
+            std::fill_n(Groups()[i].used, kGroupSize, 0);
+            for (size_t slot = 0; slot < kGroupSize; ++slot) {
+                PairTraits::construct(pair_allocator, Groups()[i].Pairs() + slot);
+            }
+        }
+        table_->group_count = group_count;
+        table_->capacity = group_count * kGroupSize;
+        table_->reseeded = false;
+        RedistributeInPlace();
+        return true;
+    }
+
+    // Every element is first marked as pending (3) and then moved to the first empty or pending
+    // slot of its new probe sequence; a pending element found there is swapped out and placed
+    // next, so slots marked used are final and lookups stay correct.
+    void RedistributeInPlace() {
+        for (size_t i = 0; i < SlotCount(); ++i) {
+            Used(i) = Used(i) == 1 ? 3 : 0;
+        }
+        table_->tombstones = 0;
+        for (size_t i = 0; i < SlotCount(); ++i) {
+            while (Used(i) == 3) {
+                size_t target = FindFreeSlot(Pair(i).first);
+                if (target == i) {
+                    Used(i) = 1;
+                } else if (Used(target) == 0) {
+                    Pair(target) = Pair(i);
+                    Used(target) = 1;
+                    Used(i) = 0;
+                } else {
+                    std::swap(Pair(i), Pair(target));
+                    Used(target) = 1;
+                }
+            }
+        }
+    }
+
+    size_t FindFreeSlot(const KeyType& key) const {
+        size_t hash = HashOf(key), shift_hash = ComputeShiftHash(hash);
+        size_t group = hash & (table_->group_count - 1);
+        while (true) {
+            const Group& current = Groups()[group];
+            for (size_t slot = 0; slot < kGroupSize; ++slot) {
+                if (current.used[slot] == 0 || current.used[slot] == 3) {
+                    return group * kGroupSize + slot;
+                }
+            }
+            group = (group + shift_hash) & (table_->group_count - 1);
+        }
+    }
+
+    static uint8_t WaitWhileBusy(std::atomic_ref<uint8_t> used) {
+        uint8_t state;
+        while ((state = used.load(std::memory_order_acquire)) == kBusy) {
+            std::this_thread::yield();
+        }
+        return state;
+    }
+
+    // Thread-safe insertion into a table that does not grow meanwhile: the first empty slot on
+    // the probe sequence is claimed by CAS on its control byte and released as used once the
+    // pair is written, so concurrent inserters of the same key wait for it and see the key.
+    // Overwriting the value of a present key is only safe if no other thread inserts that key.
+    bool ConcurrentInsert(size_t hash, const KeyType& key, const ValueType& value,
+                          bool overwrite = false) {
+        size_t shift_hash = ComputeShiftHash(hash);
+        size_t group = hash & (table_->group_count - 1);
+        while (true) {
+            Group& current = Groups()[group];
+            for (size_t slot = 0; slot < kGroupSize; ++slot) {
+                std::atomic_ref<uint8_t> used(current.used[slot]);
+                uint8_t state = WaitWhileBusy(used);
+                while (state == 0 &&
+                       !used.compare_exchange_weak(state, kBusy, std::memory_order_acquire)) {
+                    state = WaitWhileBusy(used);
+                }
+                if (state == 0) {
+                    try {
+                        current.Pairs()[slot].first = key;
+                        current.Pairs()[slot].second = value;
+                    } catch (...) {
+                        used.store(0, std::memory_order_release);
+                        throw;
+                    }
+                    used.store(1, std::memory_order_release);
+                    return true;
+                }
+                if (state == 1 && current.Pairs()[slot].first == key) {
+                    if (overwrite) {
+                        current.Pairs()[slot].second = value;
+                    }
+                    return false;
+                }
+            }
+            group = (group + shift_hash) & (table_->group_count - 1);
         }
-        delete[] new_used;
-        delete[] new_pairs;
     }
 };
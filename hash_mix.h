@@ -0,0 +1,101 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <thread>
+#include <type_traits>
+
+// Finalizers that HashMap applies to the result of its hash function. Tables index groups by the
+// low bits of the hash, so a weak hash such as the identity std::hash on integers sends every
+// multiple of the group count to the same home group; a finalizer spreads all input bits over
+// the low ones first.
+namespace hash_mix {
+
+// Leaves the hash as it is.
+struct Identity {
+    constexpr uint64_t operator()(uint64_t hash) const noexcept {
+        return hash;
+    }
+};
+
+// MurmurHash3's fmix64: full avalanche, two multiplications.
+struct Fmix64 {
+    constexpr static const uint64_t kFirstFactor = 0xff51afd7ed558ccdULL;
+    constexpr static const uint64_t kSecondFactor = 0xc4ceb9fe1a85ec53ULL;
+
+    constexpr uint64_t operator()(uint64_t hash) const noexcept {
+        hash ^= hash >> 33;
+        hash *= kFirstFactor;
+        hash ^= hash >> 33;
+        hash *= kSecondFactor;
+        hash ^= hash >> 33;
+        return hash;
+    }
+};
+
+// Fibonacci hashing: one multiplication by 2^64 / phi. The high half of the product depends on
+// every input bit, so it is rotated into the low half the table indexes with.
+struct Fibonacci {
+    constexpr static const uint64_t kFactor = 0x9e3779b97f4a7c15ULL;
+
+    constexpr uint64_t operator()(uint64_t hash) const noexcept {
+        return std::rotl(hash * kFactor, 32);
+    }
+};
+
+// wyhash's mum: the two halves of a full 128-bit product folded together.
+struct Mum {
+    constexpr static const uint64_t kFirstFactor = 0xa0761d6478bd642fULL;
+    constexpr static const uint64_t kSecondFactor = 0xe7037ed1a0b428dbULL;
+
+    constexpr uint64_t operator()(uint64_t hash) const noexcept {
+        __extension__ using Product = unsigned __int128;
+        Product product = static_cast<Product>(hash ^ kFirstFactor) * kSecondFactor;
+        return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+    }
+};
+
+// Finalizer applied to a hash after the seed is XORed into it. XOR only flips bits, so hashes
+// that agree in their low bits would keep agreeing under every seed; Identity is replaced by Fmix64
+// there even for hash functions that avalanche on their own.
+template <class Mix>
+using SeedMix = std::conditional_t<std::is_same_v<Mix, Identity>, Fmix64, Mix>;
+
+// Hash of key under a table seed: hash functions callable as hash(key, seed) take the seed as a
+// key, the result of any other is XORed with it and finalized by SeedMix<Mix>.
+template <class Mix, class Hash, class Key>
+constexpr uint64_t SeededHash(const Hash& hash, const Key& key, uint64_t seed) {
+    if constexpr (std::is_invocable_v<const Hash&, const Key&, uint64_t>) {
+        return Mix()(hash(key, seed));
+    } else {
+        return SeedMix<Mix>()(hash(key) ^ seed);
+    }
+}
+
+// Seed for a new table. Each thread counts from its own start derived from one random value per
+// process, and the counter is finalized, so seeds are cheap and still differ in every bit.
+inline uint64_t RandomSeed() {
+    static const uint64_t process_seed = [] {
+        std::random_device device;
+        return (uint64_t{device()} << 32) | device();
+    }();
+    thread_local uint64_t counter =
+        Fmix64()(process_seed ^ std::hash<std::thread::id>()(std::this_thread::get_id()));
+    counter += Fibonacci::kFactor;
+    return Fmix64()(counter);
+}
+}  // namespace hash_mix
+
+// Hash functions whose output is already well mixed skip the finalizer. They opt out either by
+// specializing this trait or by declaring a member type named is_avalanching.
+template <class Hash>
+struct is_avalanching : std::false_type {};
+
+template <class Hash>
+    requires requires { typename Hash::is_avalanching; }
+struct is_avalanching<Hash> : std::true_type {};
+
+template <class Hash>
+constexpr bool is_avalanching_v = is_avalanching<Hash>::value;
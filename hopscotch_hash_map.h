@@ -0,0 +1,457 @@
+#pragma once
+#include "hash_mix.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+// Mix finalizes every hash before it picks a home bucket, unless Hash is marked as avalanching.
+template <class KeyType, class ValueType, class Hash = std::hash<KeyType>,
+          class Mix = hash_mix::Fmix64>
+class HopscotchHashMap {
+    struct Slot;
+
+public:
+    HopscotchHashMap(Hash hash = Hash()) : hash_(hash) {
+        InitMemory(kInitialSize);
+    }
+
+    template <typename init_iterator>
+    HopscotchHashMap(init_iterator begin, init_iterator end, Hash hash = Hash()) : hash_(hash) {
+        InitMemory(kInitialSize);
+        for (auto it = begin; it != end; it++) {
+            Insert(*it);
+        }
+    }
+
+    HopscotchHashMap(const std::initializer_list<std::pair<KeyType, ValueType>>& initial_list,
+                     Hash hash = Hash())
+        : hash_(hash) {
+        InitMemory(kInitialSize);
+        for (auto it = initial_list.begin(); it != initial_list.end(); it++) {
+            Insert(*it);
+        }
+    }
+
+    HopscotchHashMap(const HopscotchHashMap& other) : hash_(other.hash_) {
+        InitMemory(other.capacity_);
+        try {
+            std::copy(other.pairs_, other.pairs_ + other.capacity_ + kNeighborhood - 1, pairs_);
+        } catch (...) {
+            ClearMemory();
+            throw;
+        }
+        std::copy(other.slots_, other.slots_ + other.capacity_ + kNeighborhood - 1, slots_);
+        size_ = other.size_;
+    }
+
+    // The source is left empty with a table of its own, as after Clear().
+    HopscotchHashMap(HopscotchHashMap&& other)
+        : hash_(other.hash_),
+          pairs_(other.pairs_),
+          slots_(other.slots_),
+          size_(other.size_),
+          capacity_(other.capacity_) {
+        other.InitMemory(kInitialSize);
+    }
+
+    HopscotchHashMap& operator=(const HopscotchHashMap& other) {
+        if (this == &other) {
+            return *this;
+        }
+        HopscotchHashMap copy(other);
+        std::swap(pairs_, copy.pairs_);
+        std::swap(slots_, copy.slots_);
+        std::swap(size_, copy.size_);
+        std::swap(capacity_, copy.capacity_);
+        std::swap(hash_, copy.hash_);
+        return *this;
+    }
+
+    HopscotchHashMap& operator=(HopscotchHashMap&& other) {
+        if (this == &other) {
+            return *this;
+        }
+        // The source gets its empty table first, so that a failed allocation changes neither map.
+        std::pair<KeyType, ValueType>* pairs = other.pairs_;
+        Slot* slots = other.slots_;
+        size_t size = other.size_, capacity = other.capacity_;
+        other.InitMemory(kInitialSize);
+        ClearMemory();
+        pairs_ = pairs;
+        slots_ = slots;
+        size_ = size;
+        capacity_ = capacity;
+        std::swap(hash_, other.hash_);
+        return *this;
+    }
+
+    ~HopscotchHashMap() {
+        ClearMemory();
+    }
+
+    void Insert(const std::pair<KeyType, ValueType>& item) {
+        if (FindIndex(item.first) != kNotFound) {
+            return;
+        }
+        CreatePair(item.first, item.second);
+    }
+
+    void Erase(const KeyType& key) {
+        size_t home = HomeBucket(key);
+        size_t index = FindIndex(key);
+        if (index == kNotFound) {
+            return;
+        }
+        slots_[home].hop_info &= ~(kOne << (index - home));
+        pairs_[index] = {KeyType{}, ValueType{}};
+        slots_[index].used = false;
+        size_--;
+        CheckInsufficientLoad();
+    }
+
+    ValueType& operator[](const KeyType& key) {
+        size_t index = FindIndex(key);
+        if (index == kNotFound) {
+            index = CreatePair(key, ValueType{});
+        }
+        return pairs_[index].second;
+    }
+
+    const ValueType& At(const KeyType& key) const {
+        size_t index = FindIndex(key);
+        if (index == kNotFound) {
+            throw std::out_of_range("The key doesn't exist");
+        }
+        return pairs_[index].second;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    void Clear() {
+        ClearMemory();
+        InitMemory(kInitialSize);
+    }
+
+    Hash HashFunction() const {
+        return hash_;
+    }
+
+    class iterator {  // NOLINT
+    public:
+        iterator() : ptr_(nullptr), slot_(nullptr), end_(nullptr) {
+        }
+        iterator(std::pair<KeyType, ValueType>* ptr, const Slot* slot,
+                 std::pair<KeyType, ValueType>* end)
+            : ptr_(ptr), slot_(slot), end_(end) {
+        }
+
+        std::pair<const KeyType, ValueType>& operator*() {
+            return *operator->();
+        }
+
+        std::pair<const KeyType, ValueType>* operator->() {
+            return reinterpret_cast<std::pair<const KeyType, ValueType>*>(ptr_);
+        }
+
+        iterator& operator++() {
+            while (++ptr_ != end_ && !(++slot_)->used) {
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator cur = *this;
+            ++*this;
+            return cur;
+        }
+
+        bool operator==(const iterator& other) const {
+            return ptr_ == other.ptr_;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return ptr_ != other.ptr_;
+        }
+
+    private:
+        std::pair<KeyType, ValueType>* ptr_ = nullptr;
+        const Slot* slot_ = nullptr;
+        std::pair<KeyType, ValueType>* end_ = nullptr;
+    };
+
+    class const_iterator {  // NOLINT
+    public:
+        const_iterator() : ptr_(nullptr), slot_(nullptr), end_(nullptr) {
+        }
+        const_iterator(const std::pair<KeyType, ValueType>* ptr, const Slot* slot,
+                       const std::pair<KeyType, ValueType>* end)
+            : ptr_(ptr), slot_(slot), end_(end) {
+        }
+
+        const std::pair<KeyType, ValueType>& operator*() {
+            return *ptr_;
+        }
+
+        const std::pair<KeyType, ValueType>* operator->() {
+            return ptr_;
+        }
+
+        const_iterator& operator++() {
+            while (++ptr_ != end_ && !(++slot_)->used) {
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator cur = *this;
+            ++*this;
+            return cur;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return ptr_ == other.ptr_;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return ptr_ != other.ptr_;
+        }
+
+    private:
+        const std::pair<KeyType, ValueType>* ptr_ = nullptr;
+        const Slot* slot_ = nullptr;
+        const std::pair<KeyType, ValueType>* end_ = nullptr;
+    };
+
+    iterator begin() {  // NOLINT
+        return IteratorAt<iterator>(FirstUsed());
+    }
+    iterator end() {  // NOLINT
+        return IteratorAt<iterator>(SlotCount());
+    }
+
+    const_iterator begin() const {  // NOLINT
+        return IteratorAt<const_iterator>(FirstUsed());
+    }
+    const_iterator end() const {  // NOLINT
+        return IteratorAt<const_iterator>(SlotCount());
+    }
+
+    const_iterator Find(const KeyType& key) const {
+        size_t index = FindIndex(key);
+        return IteratorAt<const_iterator>(index == kNotFound ? SlotCount() : index);
+    }
+
+    iterator Find(const KeyType& key) {
+        size_t index = FindIndex(key);
+        return IteratorAt<iterator>(index == kNotFound ? SlotCount() : index);
+    }
+
+private:
+    // Bit i of hop_info is set when bucket (home + i) holds a key whose home bucket is this one,
+    // so every candidate for a key lies within kNeighborhood consecutive buckets. The slots live
+    // apart from the pairs: at 8 bytes each, the slots of a whole neighborhood take 4 cache lines,
+    // which is all an insertion scans while it looks for a free bucket and hops it closer. A
+    // lookup reads the hop_info of the home bucket and then only the pairs its bits select, so
+    // the kNeighborhood * sizeof(pair) bytes a neighborhood of pairs spans bound the lines it may
+    // touch, not the ones it does.
+    struct Slot {
+        uint32_t hop_info = 0;
+        bool used = false;
+    };
+
+    constexpr static const size_t kNeighborhood = 32;
+    constexpr static const uint32_t kOne = 1;
+    constexpr static const uint32_t kFullNeighborhood = ~uint32_t{0};
+    constexpr static const size_t kNotFound = static_cast<size_t>(-1);
+    constexpr static const size_t kInitialSize = 2;
+    constexpr static const size_t kBottomLoadFactor = 25;
+    constexpr static const size_t kTopLoadFactor = 90;
+    constexpr static const size_t kMaxPercent = 100;
+    using AppliedMix = std::conditional_t<is_avalanching_v<Hash>, hash_mix::Identity, Mix>;
+    Hash hash_;
+    std::pair<KeyType, ValueType>* pairs_ = nullptr;
+    Slot* slots_ = nullptr;
+    size_t size_;
+    size_t capacity_;
+    // Size the table will have once the running rebuild has reinserted every key, 0 otherwise.
+    size_t rebuild_size_ = 0;
+
+    // Leaves the map untouched if an allocation fails.
+    void InitMemory(size_t new_capacity) {
+        auto* pairs = new std::pair<KeyType, ValueType>[new_capacity + kNeighborhood - 1];
+        Slot* slots;
+        try {
+            slots = new Slot[new_capacity + kNeighborhood - 1];
+        } catch (...) {
+            delete[] pairs;
+            throw;
+        }
+        pairs_ = pairs;
+        slots_ = slots;
+        size_ = 0;
+        capacity_ = new_capacity;
+    }
+
+    void ClearMemory() {
+        delete[] pairs_;
+        delete[] slots_;
+        pairs_ = nullptr;
+        slots_ = nullptr;
+    }
+
+    // Buckets past the last home one hold keys displaced from the end of the table.
+    size_t SlotCount() const {
+        return capacity_ + kNeighborhood - 1;
+    }
+
+    size_t FirstUsed() const {
+        size_t index = 0;
+        while (index != SlotCount() && !slots_[index].used) {
+            ++index;
+        }
+        return index;
+    }
+
+    template <class Iterator>
+    Iterator IteratorAt(size_t index) const {
+        return Iterator(pairs_ + index, slots_ + index, pairs_ + SlotCount());
+    }
+
+    size_t HashOf(const KeyType& key) const {
+        return static_cast<size_t>(AppliedMix()(hash_(key)));
+    }
+
+    size_t HomeBucket(const KeyType& key) const {
+        return HashOf(key) & (capacity_ - 1);
+    }
+
+    // Most keys sit in their home bucket, so its pair is fetched while hop_info is being read.
+    size_t FindIndex(const KeyType& key) const {
+        size_t home = HomeBucket(key);
+        __builtin_prefetch(pairs_ + home);
+        for (uint32_t hop = slots_[home].hop_info; hop != 0; hop &= hop - 1) {
+            size_t index = home + __builtin_ctz(hop);
+            if (pairs_[index].first == key) {
+                return index;
+            }
+        }
+        return kNotFound;
+    }
+
+    size_t CreatePair(const KeyType& key, const ValueType& value) {
+        if (kMaxPercent * (size_ + 1) > kTopLoadFactor * capacity_) {
+            Rebuild(capacity_ * 2);
+        }
+        size_t index;
+        while ((index = FindFreeSlot(HomeBucket(key))) == kNotFound) {
+            CheckNeighborhoodOverflow(key);
+            Rebuild(capacity_ * 2);
+        }
+        size_t home = HomeBucket(key);
+        pairs_[index].first = key;
+        pairs_[index].second = value;
+        slots_[index].used = true;
+        slots_[home].hop_info |= kOne << (index - home);
+        size_++;
+        return index;
+    }
+
+    // Finds an empty bucket by linear probing and hops it backwards until it lands inside the
+    // neighborhood of home. Returns kNotFound if the table has to grow.
+    size_t FindFreeSlot(size_t home) {
+        size_t free = home;
+        while (free != SlotCount() && slots_[free].used) {
+            ++free;
+        }
+        if (free == SlotCount()) {
+            return kNotFound;
+        }
+        while (free - home >= kNeighborhood) {
+            size_t moved_to = MoveCloser(free);
+            if (moved_to == free) {
+                return kNotFound;
+            }
+            free = moved_to;
+        }
+        return free;
+    }
+
+    size_t MoveCloser(size_t free) {
+        for (size_t bucket = free - kNeighborhood + 1; bucket < free; ++bucket) {
+            uint32_t hop = slots_[bucket].hop_info;
+            if (hop == 0) {
+                continue;
+            }
+            size_t offset = __builtin_ctz(hop);
+            size_t index = bucket + offset;
+            if (index >= free) {
+                continue;
+            }
+            pairs_[free] = pairs_[index];
+            slots_[free].used = true;
+            slots_[bucket].hop_info |= kOne << (free - bucket);
+            slots_[bucket].hop_info &= ~(kOne << offset);
+            slots_[index].used = false;
+            return index;
+        }
+        return free;
+    }
+
+    // Growing cannot separate keys whose full hashes are equal, so a home bucket saturated with
+    // such keys is reported instead of doubling the table forever. Neither can it help keys that
+    // share enough low bits to overflow a neighborhood in a table that is mostly empty already,
+    // which a well-mixed hash never produces. During a rebuild the load is that of the finished
+    // table, not of the keys reinserted so far.
+    void CheckNeighborhoodOverflow(const KeyType& key) const {
+        size_t home = HomeBucket(key), hash = HashOf(key);
+        bool equal_hashes = slots_[home].hop_info == kFullNeighborhood;
+        for (size_t i = 0; equal_hashes && i < kNeighborhood; ++i) {
+            equal_hashes = HashOf(pairs_[home + i].first) == hash;
+        }
+        if (equal_hashes) {
+            throw std::length_error("Too many keys with equal hashes");
+        }
+        if (kMaxPercent * std::max(size_, rebuild_size_) < kBottomLoadFactor * capacity_) {
+            throw std::length_error("Too many keys with colliding hashes");
+        }
+    }
+
+    void CheckInsufficientLoad() {
+        if (size_ >= 2 * kInitialSize && kMaxPercent * size_ < kBottomLoadFactor * capacity_) {
+            Rebuild(capacity_ / 2);
+        }
+    }
+
+    void Rebuild(size_t new_capacity) {
+        std::pair<KeyType, ValueType>* old_pairs = pairs_;
+        Slot* old_slots = slots_;
+        size_t old_capacity = capacity_, old_size = size_, outer_rebuild_size = rebuild_size_;
+        rebuild_size_ = std::max(rebuild_size_, old_size);
+        try {
+            InitMemory(new_capacity);
+            for (size_t i = 0; i < old_capacity + kNeighborhood - 1; i++) {
+                if (old_slots[i].used) {
+                    CreatePair(old_pairs[i].first, old_pairs[i].second);
+                }
+            }
+        } catch (...) {
+            if (pairs_ != old_pairs) {
+                ClearMemory();
+            }
+            pairs_ = old_pairs;
+            slots_ = old_slots;
+            capacity_ = old_capacity;
+            size_ = old_size;
+            rebuild_size_ = outer_rebuild_size;
+            throw;
+        }
+        rebuild_size_ = outer_rebuild_size;
+        delete[] old_pairs;
+        delete[] old_slots;
+    }
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include <sys/mman.h>
+
+// Serves allocations of at least threshold bytes straight from anonymous mappings backed by huge
+// pages, and everything smaller from operator new. Meant as the Allocator of a HashMap whose table
+// is large enough for TLB misses to dominate random probes.
+template <class T>
+class HugePageAllocator {
+public:
+    using value_type = T;
+
+    constexpr static const size_t kHugePageSize = size_t{1} << 21;
+    constexpr static const size_t kDefaultThreshold = size_t{1} << 24;
+
+    HugePageAllocator(size_t threshold = kDefaultThreshold) : threshold_(threshold) {
+    }
+
+    template <class U>
+    HugePageAllocator(const HugePageAllocator<U>& other) : threshold_(other.Threshold()) {
+    }
+
+    T* allocate(size_t n) {  // NOLINT
+        size_t bytes = n * sizeof(T);
+        if (bytes < threshold_) {
+            return static_cast<T*>(::operator new(bytes, std::align_val_t{alignof(T)}));
+        }
+        return static_cast<T*>(MapHugePages(MappingSize(bytes)));
+    }
+
+    void deallocate(T* ptr, size_t n) {  // NOLINT
+        size_t bytes = n * sizeof(T);
+        if (bytes < threshold_) {
+            ::operator delete(ptr, std::align_val_t{alignof(T)});
+            return;
+        }
+        munmap(ptr, MappingSize(bytes));
+    }
+
+    // Grows a mapped block with mremap, keeping its contents. Returns nullptr when the block is
+    // not mapped or the kernel refuses, in which case the caller has to copy.
+    T* Reallocate(T* ptr, size_t old_n, size_t new_n) {
+        size_t old_bytes = old_n * sizeof(T), new_bytes = new_n * sizeof(T);
+        if (old_bytes < threshold_ || new_bytes < threshold_) {
+            return nullptr;
+        }
+        void* moved = mremap(ptr, MappingSize(old_bytes), MappingSize(new_bytes), MREMAP_MAYMOVE);
+        if (moved == MAP_FAILED) {
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(moved, MappingSize(new_bytes), MADV_HUGEPAGE);
+#endif
+        return static_cast<T*>(moved);
+    }
+
+    size_t Threshold() const {
+        return threshold_;
+    }
+
+    bool operator==(const HugePageAllocator& other) const {
+        return threshold_ == other.threshold_;
+    }
+
+    bool operator!=(const HugePageAllocator& other) const {
+        return threshold_ != other.threshold_;
+    }
+
+    static size_t MappingSize(size_t bytes) {
+        return (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+
+private:
+    size_t threshold_;
+
+    // Prefers preallocated hugetlbfs pages and otherwise maps a huge-page-aligned range and asks
+    // for transparent huge pages on it.
+    static void* MapHugePages(size_t size) {
+#ifdef MAP_HUGETLB
+        void* ptr =
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                 -1, 0);
+        if (ptr != MAP_FAILED) {
+            return ptr;
+        }
+#endif
+        void* mapping = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        uintptr_t begin = reinterpret_cast<uintptr_t>(mapping);
+        uintptr_t aligned = (begin + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+        if (aligned != begin) {
+            munmap(mapping, aligned - begin);
+        }
+        munmap(reinterpret_cast<void*>(aligned + size), begin + kHugePageSize - aligned);
+#ifdef MADV_HUGEPAGE
+        madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+        return reinterpret_cast<void*>(aligned);
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include "hash_map.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Left-right map: two HashMap copies, one of which readers use while the writer updates the other.
+// Readers announce themselves in a striped read indicator and never wait. Writers are serialized;
+// each applies its operation to the copy nobody reads, switches readers over, waits until the
+// readers of the old copy are gone and replays the operation there. Suits maps that are read far
+// more often than written, since every write is applied twice and waits for readers to drain.
+template <class KeyType, class ValueType, class Hash = DefaultHash<KeyType>>
+class LeftRightHashMap {
+public:
+    LeftRightHashMap(Hash hash = Hash()) : maps_{Map(hash), Map(hash)} {
+    }
+
+    LeftRightHashMap(const LeftRightHashMap&) = delete;
+    LeftRightHashMap& operator=(const LeftRightHashMap&) = delete;
+
+    template <class Callback>
+    bool Find(const KeyType& key, Callback callback) const {
+        return Read([&](const Map& map) {
+            auto it = map.Find(key);
+            if (it == map.end()) {
+                return false;
+            }
+            callback(it->second);
+            return true;
+        });
+    }
+
+    bool Contains(const KeyType& key) const {
+        return Find(key, [](const ValueType&) {});
+    }
+
+    size_t Size() const {
+        return Read([](const Map& map) { return map.Size(); });
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    bool Insert(const std::pair<KeyType, ValueType>& item) {
+        return Write([&](Map& map) {
+            size_t size = map.Size();
+            map.Insert(item);
+            return map.Size() != size;
+        });
+    }
+
+    // Overwrites the value of key, inserting it if needed.
+    void Assign(const KeyType& key, const ValueType& value) {
+        Write([&](Map& map) {
+            map[key] = value;
+            return true;
+        });
+    }
+
+    bool Erase(const KeyType& key) {
+        return Write([&](Map& map) {
+            size_t size = map.Size();
+            map.Erase(key);
+            return map.Size() != size;
+        });
+    }
+
+    void Clear() {
+        Write([](Map& map) {
+            map.Clear();
+            return true;
+        });
+    }
+
+    Hash HashFunction() const {
+        return maps_[0].HashFunction();
+    }
+
+private:
+    using Map = HashMap<KeyType, ValueType, Hash>;
+
+    constexpr static const size_t kCacheLine = 64;
+    constexpr static const size_t kStripes = 64;
+
+    // Counts the readers inside one version; readers bump the stripe of their thread, so they only
+    // contend with readers that hash to the same stripe.
+    class ReadIndicator {
+    public:
+        void Arrive() {
+            stripes_[StripeIndex()].readers.fetch_add(1);
+        }
+
+        void Depart() {
+            stripes_[StripeIndex()].readers.fetch_sub(1);
+        }
+
+        bool Empty() const {
+            for (const Stripe& stripe : stripes_) {
+                if (stripe.readers.load() != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        struct alignas(kCacheLine) Stripe {
+            std::atomic<int64_t> readers{0};
+        };
+
+        Stripe stripes_[kStripes];
+
+        static size_t StripeIndex() {
+            thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id());
+            return index % kStripes;
+        }
+    };
+
+    Map maps_[2];
+    std::atomic<size_t> left_right_{0};
+    std::atomic<size_t> version_index_{0};
+    mutable ReadIndicator indicators_[2];
+    std::mutex writer_mutex_;
+
+    template <class Function>
+    auto Read(Function function) const {
+        size_t version = version_index_.load();
+        indicators_[version].Arrive();
+        struct Departure {
+            ReadIndicator& indicator;
+            ~Departure() {
+                indicator.Depart();
+            }
+        } departure{indicators_[version]};
+        return function(maps_[left_right_.load()]);
+    }
+
+    // If the operation throws on the first copy, nobody has seen it and that copy is restored from
+    // the other one. If the replay throws, readers already use the updated copy, so the write
+    // stands and the stale copy is restored from the updated one. Either way the copies agree
+    // again before the exception leaves.
+    template <class Function>
+    bool Write(Function function) {
+        std::lock_guard lock(writer_mutex_);
+        size_t reading = left_right_.load();
+        bool result;
+        try {
+            result = function(maps_[1 - reading]);
+        } catch (...) {
+            maps_[1 - reading] = maps_[reading];
+            throw;
+        }
+        left_right_.store(1 - reading);
+        ToggleVersion();
+        try {
+            function(maps_[reading]);
+        } catch (...) {
+            maps_[reading] = maps_[1 - reading];
+            throw;
+        }
+        return result;
+    }
+
+    // After this returns no reader can still be using the copy that was active before the switch.
+    void ToggleVersion() {
+        size_t previous = version_index_.load(), next = 1 - previous;
+        WaitForReaders(indicators_[next]);
+        version_index_.store(next);
+        WaitForReaders(indicators_[previous]);
+    }
+
+    static void WaitForReaders(const ReadIndicator& indicator) {
+        while (!indicator.Empty()) {
+            std::this_thread::yield();
+        }
+    }
+};
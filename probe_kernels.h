@@ -0,0 +1,318 @@
+#pragma once
+#include "cpu_dispatch.h"
+#include "hash_mix.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+#ifdef CPU_DISPATCH_X86
+#include <immintrin.h>
+#endif
+
+// Home groups and probe strides of integral keys whose hash is the identity, as std::hash is for
+// integers in libstdc++ and libc++, XORed with the table seed and followed by a finalizer from
+// hash_mix. A stride is the
+// polynomial in the hash with the given factors, forced odd, the way HashMap::ComputeShiftHash
+// computes it. Everything is reduced modulo the group count in the end, so once the 64-bit
+// finalizer has run, 32-bit lanes give exact results for masks below 2^32; they are widened only
+// when stored.
+namespace probe_kernels {
+
+template <class Key>
+constexpr bool kVectorizable = std::is_integral_v<Key> && (sizeof(Key) == 4 || sizeof(Key) == 8);
+
+template <class Mix>
+constexpr bool kVectorizableMix = std::is_same_v<Mix, hash_mix::Identity> ||
+                                  std::is_same_v<Mix, hash_mix::Fmix64> ||
+                                  std::is_same_v<Mix, hash_mix::Fibonacci>;
+
+template <class Key, class Mix = hash_mix::Identity>
+void ProbeStartsScalar(const Key* keys, size_t count, uint32_t mask, uint64_t seed,
+                       std::span<const size_t> factors, size_t* groups, size_t* strides) {
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t hash = static_cast<uint32_t>(Mix()(static_cast<uint64_t>(keys[i]) ^ seed));
+        uint32_t stride = 0;
+        for (size_t factor : factors) {
+            stride = stride * hash + static_cast<uint32_t>(factor);
+        }
+        groups[i] = hash & mask;
+        strides[i] = (stride & mask) | 1;
+    }
+}
+
+#ifdef CPU_DISPATCH_X86
+// Every instruction set gets the same helpers: loading keys widened to 64-bit hashes, multiplying
+// 64-bit lanes by a constant (only AVX-512DQ has a native low multiply, so it is composed of
+// 32-bit ones), finalizing and packing the low halves into 32-bit lanes. Without a finalizer only
+// the low half of the seed matters, so 4-byte keys skip the widening.
+template <class Key>
+__attribute__((target("sse2"))) __m128i LoadWide2(const Key* keys) {
+    if constexpr (sizeof(Key) == 8) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys));
+    } else {
+        __m128i narrow = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(keys));
+        __m128i extension =
+            std::is_signed_v<Key> ? _mm_srai_epi32(narrow, 31) : _mm_setzero_si128();
+        return _mm_unpacklo_epi32(narrow, extension);
+    }
+}
+
+__attribute__((target("sse2"))) inline __m128i MulConst2(__m128i values, uint64_t factor) {
+    const __m128i low = _mm_set1_epi64x(factor), high = _mm_set1_epi64x(factor >> 32);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(values, 32), low),
+                                  _mm_mul_epu32(values, high));
+    return _mm_add_epi64(_mm_mul_epu32(values, low), _mm_slli_epi64(cross, 32));
+}
+
+template <class Mix>
+__attribute__((target("sse2"))) __m128i MixLanes2(__m128i hash) {
+    if constexpr (std::is_same_v<Mix, hash_mix::Fmix64>) {
+        hash = _mm_xor_si128(hash, _mm_srli_epi64(hash, 33));
+        hash = MulConst2(hash, Mix::kFirstFactor);
+        hash = _mm_xor_si128(hash, _mm_srli_epi64(hash, 33));
+        hash = MulConst2(hash, Mix::kSecondFactor);
+        return _mm_xor_si128(hash, _mm_srli_epi64(hash, 33));
+    } else if constexpr (std::is_same_v<Mix, hash_mix::Fibonacci>) {
+        return _mm_shuffle_epi32(MulConst2(hash, Mix::kFactor), _MM_SHUFFLE(2, 3, 0, 1));
+    } else {
+        return hash;
+    }
+}
+
+__attribute__((target("sse2"))) inline __m128i PackLowBits4(__m128i low, __m128i high) {
+    return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high),
+                                           _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+template <class Key, class Mix>
+__attribute__((target("sse2"))) __m128i LoadHashes4(const Key* keys, __m128i seeds) {
+    if constexpr (sizeof(Key) == 4 && std::is_same_v<Mix, hash_mix::Identity>) {
+        return _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)),
+                             _mm_shuffle_epi32(seeds, _MM_SHUFFLE(0, 0, 0, 0)));
+    } else {
+        return PackLowBits4(MixLanes2<Mix>(_mm_xor_si128(LoadWide2(keys), seeds)),
+                            MixLanes2<Mix>(_mm_xor_si128(LoadWide2(keys + 2), seeds)));
+    }
+}
+
+// SSE2 has no 32-bit low multiply; the even and odd lanes go through the 64-bit one.
+__attribute__((target("sse2"))) inline __m128i MulLo4(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2"))) inline void StoreWidened4(size_t* out, __m128i values) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                     _mm_unpacklo_epi32(values, _mm_setzero_si128()));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2),
+                     _mm_unpackhi_epi32(values, _mm_setzero_si128()));
+}
+
+template <class Key, class Mix = hash_mix::Identity>
+__attribute__((target("sse2"))) void ProbeStartsSse2(const Key* keys, size_t count,
+                                                     uint32_t mask, uint64_t seed,
+                                                     std::span<const size_t> factors,
+                                                     size_t* groups, size_t* strides) {
+    const __m128i masks = _mm_set1_epi32(mask), ones = _mm_set1_epi32(1);
+    const __m128i seeds = _mm_set1_epi64x(static_cast<int64_t>(seed));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i hashes = LoadHashes4<Key, Mix>(keys + i, seeds), stride = _mm_setzero_si128();
+        for (size_t factor : factors) {
+            stride = _mm_add_epi32(MulLo4(stride, hashes),
+                                   _mm_set1_epi32(static_cast<uint32_t>(factor)));
+        }
+        StoreWidened4(groups + i, _mm_and_si128(hashes, masks));
+        StoreWidened4(strides + i, _mm_or_si128(_mm_and_si128(stride, masks), ones));
+    }
+    ProbeStartsScalar<Key, Mix>(keys + i, count - i, mask, seed, factors, groups + i,
+                                strides + i);
+}
+
+template <class Key>
+__attribute__((target("avx2"))) __m256i LoadWide4(const Key* keys) {
+    if constexpr (sizeof(Key) == 8) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys));
+    } else {
+        __m128i narrow = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys));
+        return std::is_signed_v<Key> ? _mm256_cvtepi32_epi64(narrow)
+                                     : _mm256_cvtepu32_epi64(narrow);
+    }
+}
+
+__attribute__((target("avx2"))) inline __m256i MulConst4(__m256i values, uint64_t factor) {
+    const __m256i low = _mm256_set1_epi64x(factor), high = _mm256_set1_epi64x(factor >> 32);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(values, 32), low),
+                                     _mm256_mul_epu32(values, high));
+    return _mm256_add_epi64(_mm256_mul_epu32(values, low), _mm256_slli_epi64(cross, 32));
+}
+
+template <class Mix>
+__attribute__((target("avx2"))) __m256i MixLanes4(__m256i hash) {
+    if constexpr (std::is_same_v<Mix, hash_mix::Fmix64>) {
+        hash = _mm256_xor_si256(hash, _mm256_srli_epi64(hash, 33));
+        hash = MulConst4(hash, Mix::kFirstFactor);
+        hash = _mm256_xor_si256(hash, _mm256_srli_epi64(hash, 33));
+        hash = MulConst4(hash, Mix::kSecondFactor);
+        return _mm256_xor_si256(hash, _mm256_srli_epi64(hash, 33));
+    } else if constexpr (std::is_same_v<Mix, hash_mix::Fibonacci>) {
+        return _mm256_shuffle_epi32(MulConst4(hash, Mix::kFactor), _MM_SHUFFLE(2, 3, 0, 1));
+    } else {
+        return hash;
+    }
+}
+
+__attribute__((target("avx2"))) inline __m256i PackLowBits8(__m256i low, __m256i high) {
+    const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    return _mm256_blend_epi32(_mm256_permutevar8x32_epi32(low, even),
+                              _mm256_permutevar8x32_epi32(high, even), 0xF0);
+}
+
+template <class Key, class Mix>
+__attribute__((target("avx2"))) __m256i LoadHashes8(const Key* keys, __m256i seeds) {
+    if constexpr (sizeof(Key) == 4 && std::is_same_v<Mix, hash_mix::Identity>) {
+        return _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys)),
+                                _mm256_shuffle_epi32(seeds, _MM_SHUFFLE(0, 0, 0, 0)));
+    } else {
+        return PackLowBits8(MixLanes4<Mix>(_mm256_xor_si256(LoadWide4(keys), seeds)),
+                            MixLanes4<Mix>(_mm256_xor_si256(LoadWide4(keys + 4), seeds)));
+    }
+}
+
+__attribute__((target("avx2"))) inline void StoreWidened8(size_t* out, __m256i values) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                        _mm256_cvtepu32_epi64(_mm256_castsi256_si128(values)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4),
+                        _mm256_cvtepu32_epi64(_mm256_extracti128_si256(values, 1)));
+}
+
+template <class Key, class Mix = hash_mix::Identity>
+__attribute__((target("avx2"))) void ProbeStartsAvx2(const Key* keys, size_t count,
+                                                     uint32_t mask, uint64_t seed,
+                                                     std::span<const size_t> factors,
+                                                     size_t* groups, size_t* strides) {
+    const __m256i masks = _mm256_set1_epi32(mask), ones = _mm256_set1_epi32(1);
+    const __m256i seeds = _mm256_set1_epi64x(static_cast<int64_t>(seed));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i hashes = LoadHashes8<Key, Mix>(keys + i, seeds), stride = _mm256_setzero_si256();
+        for (size_t factor : factors) {
+            stride = _mm256_add_epi32(_mm256_mullo_epi32(stride, hashes),
+                                      _mm256_set1_epi32(static_cast<uint32_t>(factor)));
+        }
+        StoreWidened8(groups + i, _mm256_and_si256(hashes, masks));
+        StoreWidened8(strides + i, _mm256_or_si256(_mm256_and_si256(stride, masks), ones));
+    }
+    ProbeStartsScalar<Key, Mix>(keys + i, count - i, mask, seed, factors, groups + i,
+                                strides + i);
+}
+
+// GCC 12 reports the undefined pass-through operands inside its own AVX-512 intrinsics as
+// uninitialized.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+template <class Key>
+__attribute__((target("avx512f"))) __m512i LoadWide8(const Key* keys) {
+    if constexpr (sizeof(Key) == 8) {
+        return _mm512_loadu_si512(keys);
+    } else {
+        __m256i narrow = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys));
+        return std::is_signed_v<Key> ? _mm512_cvtepi32_epi64(narrow)
+                                     : _mm512_cvtepu32_epi64(narrow);
+    }
+}
+
+__attribute__((target("avx512f"))) inline __m512i MulConst8(__m512i values, uint64_t factor) {
+    const __m512i low = _mm512_set1_epi64(factor), high = _mm512_set1_epi64(factor >> 32);
+    __m512i cross = _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(values, 32), low),
+                                     _mm512_mul_epu32(values, high));
+    return _mm512_add_epi64(_mm512_mul_epu32(values, low), _mm512_slli_epi64(cross, 32));
+}
+
+template <class Mix>
+__attribute__((target("avx512f"))) __m512i MixLanes8(__m512i hash) {
+    if constexpr (std::is_same_v<Mix, hash_mix::Fmix64>) {
+        hash = _mm512_xor_si512(hash, _mm512_srli_epi64(hash, 33));
+        hash = MulConst8(hash, Mix::kFirstFactor);
+        hash = _mm512_xor_si512(hash, _mm512_srli_epi64(hash, 33));
+        hash = MulConst8(hash, Mix::kSecondFactor);
+        return _mm512_xor_si512(hash, _mm512_srli_epi64(hash, 33));
+    } else if constexpr (std::is_same_v<Mix, hash_mix::Fibonacci>) {
+        return _mm512_rol_epi64(MulConst8(hash, Mix::kFactor), 32);
+    } else {
+        return hash;
+    }
+}
+
+__attribute__((target("avx512f"))) inline __m512i PackLowBits16(__m512i low, __m512i high) {
+    return _mm512_inserti64x4(_mm512_zextsi256_si512(_mm512_cvtepi64_epi32(low)),
+                              _mm512_cvtepi64_epi32(high), 1);
+}
+
+template <class Key, class Mix>
+__attribute__((target("avx512f"))) __m512i LoadHashes16(const Key* keys, __m512i seeds) {
+    if constexpr (sizeof(Key) == 4 && std::is_same_v<Mix, hash_mix::Identity>) {
+        return _mm512_xor_si512(_mm512_loadu_si512(keys), _mm512_shuffle_epi32(seeds, _MM_PERM_AAAA));
+    } else {
+        return PackLowBits16(MixLanes8<Mix>(_mm512_xor_si512(LoadWide8(keys), seeds)),
+                             MixLanes8<Mix>(_mm512_xor_si512(LoadWide8(keys + 8), seeds)));
+    }
+}
+
+__attribute__((target("avx512f"))) inline void StoreWidened16(size_t* out, __m512i values) {
+    _mm512_storeu_si512(out, _mm512_cvtepu32_epi64(_mm512_castsi512_si256(values)));
+    _mm512_storeu_si512(out + 8, _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(values, 1)));
+}
+
+template <class Key, class Mix = hash_mix::Identity>
+__attribute__((target("avx512f"))) void ProbeStartsAvx512(const Key* keys, size_t count,
+                                                          uint32_t mask, uint64_t seed,
+                                                          std::span<const size_t> factors,
+                                                          size_t* groups, size_t* strides) {
+    const __m512i masks = _mm512_set1_epi32(mask), ones = _mm512_set1_epi32(1);
+    const __m512i seeds = _mm512_set1_epi64(static_cast<int64_t>(seed));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i hashes = LoadHashes16<Key, Mix>(keys + i, seeds), stride = _mm512_setzero_si512();
+        for (size_t factor : factors) {
+            stride = _mm512_add_epi32(_mm512_mullo_epi32(stride, hashes),
+                                      _mm512_set1_epi32(static_cast<uint32_t>(factor)));
+        }
+        StoreWidened16(groups + i, _mm512_and_si512(hashes, masks));
+        StoreWidened16(strides + i, _mm512_or_si512(_mm512_and_si512(stride, masks), ones));
+    }
+    ProbeStartsAvx2<Key, Mix>(keys + i, count - i, mask, seed, factors, groups + i, strides + i);
+}
+#pragma GCC diagnostic pop
+#endif
+
+template <class Key>
+using ProbeStartsKernel = void (*)(const Key*, size_t, uint32_t, uint64_t,
+                                   std::span<const size_t>, size_t*, size_t*);
+
+template <class Key, class Mix = hash_mix::Identity>
+ProbeStartsKernel<Key> SelectProbeStarts(SimdLevel level) {
+#ifdef CPU_DISPATCH_X86
+    return cpu_dispatch::SelectKernel<ProbeStartsKernel<Key>>(
+        {ProbeStartsScalar<Key, Mix>, ProbeStartsSse2<Key, Mix>, ProbeStartsAvx2<Key, Mix>,
+         ProbeStartsAvx512<Key, Mix>},
+        level);
+#else
+    return cpu_dispatch::SelectKernel<ProbeStartsKernel<Key>>({ProbeStartsScalar<Key, Mix>},
+                                                              level);
+#endif
+}
+
+// Runs the kernel of the active SIMD level, chosen once per key type and finalizer.
+template <class Key, class Mix = hash_mix::Identity>
+void ProbeStarts(const Key* keys, size_t count, uint32_t mask, uint64_t seed,
+                 std::span<const size_t> factors, size_t* groups, size_t* strides) {
+    static const ProbeStartsKernel<Key> kernel =
+        SelectProbeStarts<Key, Mix>(cpu_dispatch::ActiveSimdLevel());
+    kernel(keys, count, mask, seed, factors, groups, strides);
+}
+}  // namespace probe_kernels
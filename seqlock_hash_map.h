@@ -0,0 +1,343 @@
+#pragma once
+#include "epoch_reclamation.h"
+#include "hash_mix.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+// Map for exactly one writer thread and any number of readers, laid out in cache-line groups like
+// HashMap. Every group carries a sequence counter that the writer makes odd while it modifies the
+// group; readers copy the group's slots word by word and retry only if the counter moved, so they
+// never write to the table. Keys and values are therefore restricted to trivially copyable types.
+//
+// Tombstones are never reused, which keeps each key at one position of its probe chain until the
+// next rebuild and makes a group-by-group scan consistent. Rebuilding publishes a fresh table;
+// readers may still be scanning the old one, so it is retired through epoch-based reclamation
+// and freed once every reader that could have seen it is gone. A reader announces itself once per
+// ReadSession, after which its lookups write no shared memory at all; a lookup outside a session
+// announces itself on its own, which costs a store and a fence.
+//
+// Mix finalizes every hash before it picks a group, unless Hash is marked as avalanching.
+template <class KeyType, class ValueType, class Hash = std::hash<KeyType>,
+          class Mix = hash_mix::Fmix64>
+class SeqlockHashMap {
+    static_assert(std::is_trivially_copyable_v<KeyType> && std::is_trivially_copyable_v<ValueType>,
+                  "Seqlock readers copy keys and values word by word");
+
+public:
+    SeqlockHashMap(Hash hash = Hash()) : hash_(hash) {
+        table_.store(new Table(kInitialGroups));
+    }
+
+    SeqlockHashMap(const SeqlockHashMap&) = delete;
+    SeqlockHashMap& operator=(const SeqlockHashMap&) = delete;
+
+    ~SeqlockHashMap() {
+        delete table_.load();
+        EpochManager::Instance().Reclaim();
+    }
+
+    // Keeps every table the current thread may look at alive while it exists. Tables retired
+    // meanwhile are freed only after it ends, so a reader holds one across a batch of lookups
+    // rather than for good.
+    class ReadSession {
+    private:
+        EpochGuard guard_;
+    };
+
+    // Reader side, safe from any thread. Inside a ReadSession the guard only bumps a thread-local
+    // depth.
+    bool Find(const KeyType& key, ValueType& value) const {
+        EpochGuard guard;
+        const Table* table = table_.load();
+        size_t hash = HashOf(key), shift_hash = ComputeShiftHash(table, hash);
+        size_t group = hash & (table->group_count - 1);
+        while (true) {
+            ReadResult result = ReadGroup(table->groups[group], key, value);
+            if (result != ReadResult::kContinue) {
+                return result == ReadResult::kFound;
+            }
+            group = (group + shift_hash) & (table->group_count - 1);
+        }
+    }
+
+    bool Contains(const KeyType& key) const {
+        ValueType value;
+        return Find(key, value);
+    }
+
+    size_t Size() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    Hash HashFunction() const {
+        return hash_;
+    }
+
+    // Writer side, only ever from one thread at a time.
+    bool Insert(const std::pair<KeyType, ValueType>& item) {
+        if (FindSlot(item.first).second) {
+            return false;
+        }
+        if (CheckOverload()) {
+            Rebuild();
+        }
+        auto [position, found] = FindSlot(item.first);
+        Group& group = Groups()[position / kGroupSize];
+        Slot& slot = group.slots[position % kGroupSize];
+        uint32_t version = BeginWrite(group);
+        StoreWords(slot.key, item.first);
+        StoreWords(slot.value, item.second);
+        group.control[position % kGroupSize].store(kFull, std::memory_order_relaxed);
+        EndWrite(group, version);
+        size_.store(Size() + 1, std::memory_order_relaxed);
+        ++used_;
+        return true;
+    }
+
+    // Overwrites the value of key, inserting it if needed.
+    void Assign(const KeyType& key, const ValueType& value) {
+        auto [position, found] = FindSlot(key);
+        if (!found) {
+            Insert({key, value});
+            return;
+        }
+        Group& group = Groups()[position / kGroupSize];
+        uint32_t version = BeginWrite(group);
+        StoreWords(group.slots[position % kGroupSize].value, value);
+        EndWrite(group, version);
+    }
+
+    bool Erase(const KeyType& key) {
+        auto [position, found] = FindSlot(key);
+        if (!found) {
+            return false;
+        }
+        Group& group = Groups()[position / kGroupSize];
+        uint32_t version = BeginWrite(group);
+        group.control[position % kGroupSize].store(kDeleted, std::memory_order_relaxed);
+        EndWrite(group, version);
+        size_.store(Size() - 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Frees the tables replaced by rebuilds that no reader can still see. Every rebuild does so
+    // too, so this only matters once the writer stops rebuilding.
+    void ReleaseRetired() {
+        EpochManager::Instance().Reclaim();
+    }
+
+private:
+    constexpr static const size_t kCacheLine = 64;
+    constexpr static const size_t kMaxGroupSize = 16;
+    constexpr static const size_t kWordSize = sizeof(uint64_t);
+    constexpr static const size_t kKeyWords = (sizeof(KeyType) + kWordSize - 1) / kWordSize;
+    constexpr static const size_t kValueWords = (sizeof(ValueType) + kWordSize - 1) / kWordSize;
+    constexpr static const size_t kGroupSize = std::clamp<size_t>(
+        (kCacheLine - sizeof(uint32_t)) / ((kKeyWords + kValueWords) * kWordSize + 1), 1,
+        kMaxGroupSize);
+    constexpr static const size_t kInitialGroups = 2;
+    constexpr static const size_t kShiftHashFactors[] = {239, 179, 191};
+    constexpr static const size_t kBottomLoadFactor = 25;
+    constexpr static const size_t kTopLoadFactor = 50;
+    constexpr static const size_t kMaxPercent = 100;
+    using AppliedMix = std::conditional_t<is_avalanching_v<Hash>, hash_mix::Identity, Mix>;
+    constexpr static const uint8_t kEmpty = 0;
+    constexpr static const uint8_t kFull = 1;
+    constexpr static const uint8_t kDeleted = 2;
+
+    enum class ReadResult { kFound, kAbsent, kContinue };
+
+    struct Slot {
+        std::atomic<uint64_t> key[kKeyWords];
+        std::atomic<uint64_t> value[kValueWords];
+    };
+
+    struct alignas(kCacheLine) Group {
+        std::atomic<uint32_t> version{0};
+        std::atomic<uint8_t> control[kGroupSize] = {};
+        Slot slots[kGroupSize];
+    };
+
+    struct Table {
+        size_t group_count;
+        std::unique_ptr<Group[]> groups;
+
+        explicit Table(size_t group_count)
+            : group_count(group_count), groups(new Group[group_count]) {
+        }
+    };
+
+    Hash hash_;
+    std::atomic<Table*> table_;
+    std::atomic<size_t> size_{0};
+    size_t used_ = 0;
+
+    template <class T, size_t N>
+    static void StoreWords(std::atomic<uint64_t> (&words)[N], const T& value) {
+        uint64_t buffer[N] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        for (size_t i = 0; i < N; ++i) {
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+    }
+
+    template <class T, size_t N>
+    static T LoadWords(const std::atomic<uint64_t> (&words)[N]) {
+        uint64_t buffer[N];
+        for (size_t i = 0; i < N; ++i) {
+            buffer[i] = words[i].load(std::memory_order_relaxed);
+        }
+        struct Raw {
+            alignas(T) unsigned char bytes[sizeof(T)];
+        } raw;
+        std::memcpy(raw.bytes, buffer, sizeof(T));
+        return std::bit_cast<T>(raw);
+    }
+
+    static uint32_t BeginWrite(Group& group) {
+        uint32_t version = group.version.load(std::memory_order_relaxed);
+        group.version.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return version;
+    }
+
+    static void EndWrite(Group& group, uint32_t version) {
+        group.version.store(version + 2, std::memory_order_release);
+    }
+
+    static ReadResult ReadGroup(const Group& group, const KeyType& key, ValueType& value) {
+        while (true) {
+            uint32_t version = group.version.load(std::memory_order_acquire);
+            if (version & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            ReadResult result = ReadResult::kContinue;
+            ValueType candidate;
+            for (size_t slot = 0; slot < kGroupSize; ++slot) {
+                uint8_t control = group.control[slot].load(std::memory_order_relaxed);
+                if (control == kEmpty) {
+                    result = ReadResult::kAbsent;
+                    break;
+                }
+                if (control == kFull && LoadWords<KeyType>(group.slots[slot].key) == key) {
+                    candidate = LoadWords<ValueType>(group.slots[slot].value);
+                    result = ReadResult::kFound;
+                    break;
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (group.version.load(std::memory_order_relaxed) == version) {
+                if (result == ReadResult::kFound) {
+                    value = candidate;
+                }
+                return result;
+            }
+        }
+    }
+
+    Group* Groups() const {
+        return table_.load(std::memory_order_relaxed)->groups.get();
+    }
+
+    size_t Capacity() const {
+        return table_.load(std::memory_order_relaxed)->group_count * kGroupSize;
+    }
+
+    size_t HashOf(const KeyType& key) const {
+        return static_cast<size_t>(AppliedMix()(hash_(key)));
+    }
+
+    static size_t ComputeShiftHash(const Table* table, size_t primary_hash) {
+        size_t res = 0;
+        for (size_t rate : kShiftHashFactors) {
+            res = (res * primary_hash + rate) & (table->group_count - 1);
+        }
+        return res | 1;
+    }
+
+    // Returns the position of key, or the first empty slot of its probe chain.
+    std::pair<size_t, bool> FindSlot(const KeyType& key) const {
+        const Table* table = table_.load(std::memory_order_relaxed);
+        size_t hash = HashOf(key), shift_hash = ComputeShiftHash(table, hash);
+        size_t group = hash & (table->group_count - 1);
+        while (true) {
+            const Group& current = table->groups[group];
+            for (size_t slot = 0; slot < kGroupSize; ++slot) {
+                uint8_t control = current.control[slot].load(std::memory_order_relaxed);
+                if (control == kEmpty) {
+                    return {group * kGroupSize + slot, false};
+                }
+                if (control == kFull && LoadWords<KeyType>(current.slots[slot].key) == key) {
+                    return {group * kGroupSize + slot, true};
+                }
+            }
+            group = (group + shift_hash) & (table->group_count - 1);
+        }
+    }
+
+    // Tombstones are never reused, so every slot ever filled counts towards the load.
+    bool CheckOverload() const {
+        return kMaxPercent * (used_ + 1) > kTopLoadFactor * Capacity();
+    }
+
+    // Copies the live elements into a fresh table, twice as large unless most used slots are
+    // tombstones, and publishes it.
+    void Rebuild() {
+        Table* old_table = table_.load(std::memory_order_relaxed);
+        size_t group_count = old_table->group_count;
+        if (kMaxPercent * (Size() + 1) > kBottomLoadFactor * Capacity()) {
+            group_count *= 2;
+        }
+        auto table = std::make_unique<Table>(group_count);
+        for (size_t group = 0; group < old_table->group_count; ++group) {
+            const Group& current = old_table->groups[group];
+            for (size_t slot = 0; slot < kGroupSize; ++slot) {
+                if (current.control[slot].load(std::memory_order_relaxed) != kFull) {
+                    continue;
+                }
+                KeyType key = LoadWords<KeyType>(current.slots[slot].key);
+                size_t hash = HashOf(key), shift_hash = ComputeShiftHash(table.get(), hash);
+                size_t target = hash & (group_count - 1);
+                while (true) {
+                    Group& destination = table->groups[target];
+                    auto free = std::find_if(
+                        std::begin(destination.control), std::end(destination.control),
+                        [](const std::atomic<uint8_t>& control) {
+                            return control.load(std::memory_order_relaxed) == kEmpty;
+                        });
+                    if (free != std::end(destination.control)) {
+                        size_t index = free - std::begin(destination.control);
+                        for (size_t i = 0; i < kKeyWords; ++i) {
+                            destination.slots[index].key[i].store(
+                                current.slots[slot].key[i].load(std::memory_order_relaxed),
+                                std::memory_order_relaxed);
+                        }
+                        for (size_t i = 0; i < kValueWords; ++i) {
+                            destination.slots[index].value[i].store(
+                                current.slots[slot].value[i].load(std::memory_order_relaxed),
+                                std::memory_order_relaxed);
+                        }
+                        free->store(kFull, std::memory_order_relaxed);
+                        break;
+                    }
+                    target = (target + shift_hash) & (group_count - 1);
+                }
+            }
+        }
+        used_ = Size();
+        table_.store(table.release());
+        EpochManager::Instance().Retire([old_table] { delete old_table; });
+    }
+};
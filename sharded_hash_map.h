@@ -0,0 +1,114 @@
+#pragma once
+#include "hash_map.h"
+#include <array>
+#include <bit>
+#include <mutex>
+#include <shared_mutex>
+
+// Splits keys between Shards independently locked HashMaps, picking the shard by the high bits of
+// the multiplied hash. Callbacks run under the shard lock: shared for Find, exclusive otherwise.
+template <class KeyType, class ValueType, class Hash = DefaultHash<KeyType>, size_t Shards = 64>
+class ShardedHashMap {
+    static_assert(Shards > 0 && (Shards & (Shards - 1)) == 0,
+                  "The number of shards must be a power of two");
+
+public:
+    ShardedHashMap(Hash hash = Hash()) : hash_(hash) {
+        for (Shard& shard : shards_) {
+            shard.map = HashMap<KeyType, ValueType, Hash>(hash);
+        }
+    }
+
+    template <class Callback>
+    bool Find(const KeyType& key, Callback callback) const {
+        const Shard& shard = ShardFor(key);
+        std::shared_lock lock(shard.mutex);
+        auto it = shard.map.Find(key);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        callback(it->second);
+        return true;
+    }
+
+    bool Contains(const KeyType& key) const {
+        return Find(key, [](const ValueType&) {});
+    }
+
+    bool Insert(const std::pair<KeyType, ValueType>& item) {
+        Shard& shard = ShardFor(item.first);
+        std::unique_lock lock(shard.mutex);
+        size_t size = shard.map.Size();
+        shard.map.Insert(item);
+        return shard.map.Size() != size;
+    }
+
+    bool Erase(const KeyType& key) {
+        Shard& shard = ShardFor(key);
+        std::unique_lock lock(shard.mutex);
+        size_t size = shard.map.Size();
+        shard.map.Erase(key);
+        return shard.map.Size() != size;
+    }
+
+    // Runs callback on the value of key, inserting a default-constructed value first if needed.
+    template <class Callback>
+    void Upsert(const KeyType& key, Callback callback) {
+        Shard& shard = ShardFor(key);
+        std::unique_lock lock(shard.mutex);
+        callback(shard.map[key]);
+    }
+
+    size_t Size() const {
+        size_t size = 0;
+        for (const Shard& shard : shards_) {
+            std::shared_lock lock(shard.mutex);
+            size += shard.map.Size();
+        }
+        return size;
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    void Clear() {
+        for (Shard& shard : shards_) {
+            std::unique_lock lock(shard.mutex);
+            shard.map.Clear();
+        }
+    }
+
+    Hash HashFunction() const {
+        return hash_;
+    }
+
+private:
+    constexpr static const size_t kCacheLine = 64;
+    constexpr static const uint64_t kFibonacciFactor = 0x9e3779b97f4a7c15;
+    constexpr static const size_t kShardBits = std::bit_width(Shards) - 1;
+
+    struct alignas(kCacheLine) Shard {
+        mutable std::shared_mutex mutex;
+        HashMap<KeyType, ValueType, Hash> map;
+    };
+
+    Hash hash_;
+    std::array<Shard, Shards> shards_;
+
+    size_t ShardIndex(const KeyType& key) const {
+        if constexpr (kShardBits == 0) {
+            return 0;
+        } else {
+            return (static_cast<uint64_t>(hash_(key)) * kFibonacciFactor) >> (64 - kShardBits);
+        }
+    }
+
+    Shard& ShardFor(const KeyType& key) {
+        return shards_[ShardIndex(key)];
+    }
+
+    const Shard& ShardFor(const KeyType& key) const {
+        return shards_[ShardIndex(key)];
+    }
+};
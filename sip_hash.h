@@ -0,0 +1,86 @@
+#pragma once
+#include "hash_mix.h"
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// SipHash, a keyed pseudorandom function: without the key, nobody can compute which inputs
+// collide, however many hashes they observe. SipHash-c-d runs c rounds per 8-byte word and d
+// rounds at the end; 2-4 is the original parameter set, 1-3 the faster one Python and Rust use
+// for their hash tables.
+namespace sip_hash {
+
+struct State {
+    uint64_t v0, v1, v2, v3;
+
+    void Round() {
+        v0 += v1;
+        v1 = std::rotl(v1, 13) ^ v0;
+        v0 = std::rotl(v0, 32);
+        v2 += v3;
+        v3 = std::rotl(v3, 16) ^ v2;
+        v0 += v3;
+        v3 = std::rotl(v3, 21) ^ v0;
+        v2 += v1;
+        v1 = std::rotl(v1, 17) ^ v2;
+        v2 = std::rotl(v2, 32);
+    }
+
+    template <size_t Rounds>
+    void Absorb(uint64_t word) {
+        v3 ^= word;
+        for (size_t i = 0; i < Rounds; ++i) {
+            Round();
+        }
+        v0 ^= word;
+    }
+};
+
+template <size_t CompressionRounds, size_t FinalizationRounds>
+uint64_t Hash(std::string_view bytes, uint64_t k0, uint64_t k1) {
+    State state{k0 ^ 0x736f6d6570736575ULL, k1 ^ 0x646f72616e646f6dULL,
+                k0 ^ 0x6c7967656e657261ULL, k1 ^ 0x7465646279746573ULL};
+    const char* data = bytes.data();
+    size_t words = bytes.size() / sizeof(uint64_t);
+    for (size_t i = 0; i < words; ++i, data += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        state.Absorb<CompressionRounds>(word);
+    }
+    // The last word holds the remaining bytes and the length modulo 256 in its top byte.
+    uint64_t last = static_cast<uint64_t>(bytes.size()) << 56;
+    for (size_t i = 0; i < bytes.size() % sizeof(uint64_t); ++i) {
+        last |= uint64_t{static_cast<unsigned char>(data[i])} << (8 * i);
+    }
+    state.Absorb<CompressionRounds>(last);
+    state.v2 ^= 0xff;
+    for (size_t i = 0; i < FinalizationRounds; ++i) {
+        state.Round();
+    }
+    return state.v0 ^ state.v1 ^ state.v2 ^ state.v3;
+}
+}  // namespace sip_hash
+
+// SipHash-1-3 for HashMap keys that come from untrusted input: strings and integers. HashMap
+// passes the seed of its table, which is expanded into the 128-bit key; for the same seed the
+// function is deterministic, e.g. for tests. It is several times slower than StringHash and only
+// worth it where an attacker may learn enough about the seed to aim at StringHash.
+struct SipHash {
+    using is_avalanching = void;
+    using is_transparent = void;
+
+    size_t operator()(std::string_view bytes, uint64_t seed = 0) const noexcept {
+        return static_cast<size_t>(sip_hash::Hash<1, 3>(bytes, seed, hash_mix::Fmix64()(~seed)));
+    }
+
+    template <std::integral Key>
+    size_t operator()(Key key, uint64_t seed = 0) const noexcept {
+        uint64_t word = static_cast<uint64_t>(key);
+        char bytes[sizeof(word)];
+        std::memcpy(bytes, &word, sizeof(word));
+        return (*this)(std::string_view(bytes, sizeof(bytes)), seed);
+    }
+};
@@ -0,0 +1,343 @@
+#pragma once
+#include "cpu_dispatch.h"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#ifdef CPU_DISPATCH_X86
+#include <immintrin.h>
+#endif
+
+// Hash for byte strings in the style of wyhash and XXH3 (its own constants, so the values match
+// neither). Strings of up to 64 bytes take wyhash's path: a few overlapping little-endian reads
+// folded by 128-bit multiplications. Longer ones feed 64-byte stripes into eight 64-bit
+// accumulators with XXH3's 32x32-bit multiply-accumulate, which SIMD kernels run a whole stripe
+// at a time with identical results, and are folded with the same multiplications at the end. A
+// seed enters the initial state of the short path and, as in XXH3, the stripe secret of the long
+// one; seed zero gives the unseeded values. Constant evaluation takes the scalar path on chars and
+// yields the same values, so layouts computed at compile time stay valid at run time.
+namespace string_hash {
+
+constexpr size_t kShortLength = 64;
+constexpr size_t kStripeSize = 64;
+constexpr size_t kLanes = kStripeSize / sizeof(uint64_t);
+// Accumulators are scrambled after every block of stripes, so that no input bit can stay in the
+// high half of a lane where the multiplications never reach it.
+constexpr size_t kStripesPerBlock = 16;
+constexpr uint64_t kScrambleFactor = 0x9e3779b1;
+constexpr uint64_t kSecret[] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+                                0x8ebc6af09c88c6e3ULL};
+constexpr uint64_t kStripeSecret[kLanes] = {
+    0x138dda71e3658967ULL, 0x0a3aee4966660879ULL, 0xe338e970dc1afab9ULL, 0xa27056f73a818b9fULL,
+    0x89bc15a5956f5c71ULL, 0xcd6a4292f27baaf9ULL, 0xc87ced6d11a64ad3ULL, 0x0df0fadcd3393b0fULL};
+constexpr uint64_t kInitialAccumulators[kLanes] = {
+    0x07e70715d7d8a6c3ULL, 0x8c75603722a8ff1dULL, 0x4b9a3682eb66f989ULL, 0xb6989668f7c8122bULL,
+    0xc33709e3ef3ca885ULL, 0x65e12e6a17c9b327ULL, 0xb4895688f96fe973ULL, 0x7881549127f6e649ULL};
+constexpr uint64_t kMergeSecret[kLanes] = {
+    0xd4a4405777321e85ULL, 0x75a75f2013069e53ULL, 0x9e8c85898b5f46afULL, 0x562d3d5c39f2a8a7ULL,
+    0x9840ede51b4ea5c3ULL, 0xe06ced8c5ad02341ULL, 0x9bf05d6111ac0c77ULL, 0x75dc203b55e8dc41ULL};
+
+constexpr uint64_t Mum(uint64_t a, uint64_t b) {
+    __extension__ using Product = unsigned __int128;
+    Product product = static_cast<Product>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+// Constant evaluation cannot reinterpret bytes, so it assembles the word in the order memcpy gives.
+template <class Word, class Byte>
+constexpr Word ReadWord(const Byte* data) {
+    if (std::is_constant_evaluated()) {
+        Word value = 0;
+        for (size_t i = 0; i < sizeof(Word); ++i) {
+            size_t byte = std::endian::native == std::endian::little ? i : sizeof(Word) - 1 - i;
+            value |= static_cast<Word>(static_cast<unsigned char>(data[i])) << (8 * byte);
+        }
+        return value;
+    }
+    Word value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+template <class Byte>
+constexpr uint64_t Read8(const Byte* data) {
+    return ReadWord<uint64_t>(data);
+}
+
+template <class Byte>
+constexpr uint64_t Read4(const Byte* data) {
+    return ReadWord<uint32_t>(data);
+}
+
+template <class Byte>
+constexpr uint64_t Read1(const Byte* data) {
+    return static_cast<unsigned char>(*data);
+}
+
+// The seed enters both operands of every multiplication: an operand an attacker can zero without
+// knowing the seed would zero the product and wipe the seed out of the state.
+template <class Byte>
+constexpr uint64_t HashShort(const Byte* data, size_t length, uint64_t seed) {
+    seed ^= Mum(seed ^ kSecret[0], kSecret[1]);
+    uint64_t a = 0, b = 0;
+    if (length >= 4 && length <= 16) {
+        size_t middle = (length >> 3) << 2;
+        a = (Read4(data) << 32) | Read4(data + middle);
+        b = (Read4(data + length - 4) << 32) | Read4(data + length - 4 - middle);
+    } else if (length > 16) {
+        size_t rest = length;
+        for (; rest > 16; rest -= 16, data += 16) {
+            seed = Mum(Read8(data) ^ kSecret[1] ^ seed, Read8(data + 8) ^ seed);
+        }
+        a = Read8(data + rest - 16);
+        b = Read8(data + rest - 8);
+    } else if (length > 0) {
+        a = (Read1(data) << 16) | (Read1(data + (length >> 1)) << 8) | Read1(data + length - 1);
+    }
+    return Mum(Mum(a ^ kSecret[1] ^ seed, b ^ seed) ^ kSecret[0] ^ length, kSecret[2]);
+}
+
+// The seed is added to the even lanes of the stripe secret and subtracted from the odd ones.
+constexpr uint64_t SeededSecret(size_t lane, uint64_t seed) {
+    return lane % 2 == 0 ? kStripeSecret[lane] + seed : kStripeSecret[lane] - seed;
+}
+
+template <class Byte>
+constexpr void AccumulateStripeScalar(uint64_t* accumulators, const uint64_t* secret,
+                                      const Byte* stripe) {
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        uint64_t data = Read8(stripe + lane * sizeof(uint64_t));
+        uint64_t keyed = data ^ secret[lane];
+        accumulators[lane ^ 1] += data;
+        accumulators[lane] += (keyed & 0xffffffff) * (keyed >> 32);
+    }
+}
+
+constexpr void ScrambleScalar(uint64_t* accumulators, const uint64_t* secret) {
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        uint64_t value = accumulators[lane];
+        accumulators[lane] = (value ^ (value >> 47) ^ secret[lane]) * kScrambleFactor;
+    }
+}
+
+// Every kernel walks the same stripes: the complete ones before the last byte, then the final 64
+// bytes, which may overlap the previous stripe.
+template <class Byte>
+constexpr void AccumulateScalar(uint64_t* accumulators, const Byte* data, size_t length,
+                                uint64_t seed) {
+    uint64_t acc[kLanes], secret[kLanes];
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        acc[lane] = kInitialAccumulators[lane];
+        secret[lane] = SeededSecret(lane, seed);
+    }
+    size_t stripes = (length - 1) / kStripeSize;
+    for (size_t stripe = 0; stripe < stripes; ++stripe) {
+        AccumulateStripeScalar(acc, secret, data + stripe * kStripeSize);
+        if (stripe % kStripesPerBlock == kStripesPerBlock - 1) {
+            ScrambleScalar(acc, secret);
+        }
+    }
+    AccumulateStripeScalar(acc, secret, data + length - kStripeSize);
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        accumulators[lane] = acc[lane];
+    }
+}
+
+#ifdef CPU_DISPATCH_X86
+// The kernels multiply the 32-bit halves of each 64-bit lane with mul_epu32 and add every lane's
+// data to its neighbour by swapping the lanes pairwise. They derive the seeded secret in registers
+// rather than reading it back from memory.
+__attribute__((target("sse2"))) inline __m128i ScrambleLanes2(__m128i value, __m128i secret) {
+    const __m128i factor = _mm_set1_epi64x(kScrambleFactor);
+    value = _mm_xor_si128(_mm_xor_si128(value, _mm_srli_epi64(value, 47)), secret);
+    return _mm_add_epi64(_mm_mul_epu32(value, factor),
+                         _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(value, 32), factor), 32));
+}
+
+__attribute__((target("sse2"))) inline __m128i AccumulateLanes2(__m128i acc, __m128i secret,
+                                                                 const unsigned char* data) {
+    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    __m128i keyed = _mm_xor_si128(value, secret);
+    __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+    __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+}
+
+__attribute__((target("sse2"))) inline void AccumulateSse2(uint64_t* accumulators,
+                                                           const unsigned char* data,
+                                                           size_t length, uint64_t seed) {
+    constexpr size_t kVectors = kStripeSize / sizeof(__m128i);
+    const __m128i seeds = _mm_set_epi64x(static_cast<int64_t>(-seed), static_cast<int64_t>(seed));
+    __m128i acc[kVectors], secret[kVectors];
+    for (size_t i = 0; i < kVectors; ++i) {
+        acc[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kInitialAccumulators) + i);
+        secret[i] = _mm_add_epi64(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(kStripeSecret) + i), seeds);
+    }
+    size_t stripes = (length - 1) / kStripeSize;
+    for (size_t stripe = 0; stripe < stripes; ++stripe) {
+        for (size_t i = 0; i < kVectors; ++i) {
+            acc[i] = AccumulateLanes2(acc[i], secret[i],
+                                      data + stripe * kStripeSize + i * sizeof(__m128i));
+        }
+        if (stripe % kStripesPerBlock == kStripesPerBlock - 1) {
+            for (size_t i = 0; i < kVectors; ++i) {
+                acc[i] = ScrambleLanes2(acc[i], secret[i]);
+            }
+        }
+    }
+    for (size_t i = 0; i < kVectors; ++i) {
+        acc[i] = AccumulateLanes2(acc[i], secret[i],
+                                  data + length - kStripeSize + i * sizeof(__m128i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(accumulators) + i, acc[i]);
+    }
+}
+
+__attribute__((target("avx2"))) inline __m256i ScrambleLanes4(__m256i value, __m256i secret) {
+    const __m256i factor = _mm256_set1_epi64x(kScrambleFactor);
+    value = _mm256_xor_si256(_mm256_xor_si256(value, _mm256_srli_epi64(value, 47)), secret);
+    return _mm256_add_epi64(
+        _mm256_mul_epu32(value, factor),
+        _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(value, 32), factor), 32));
+}
+
+__attribute__((target("avx2"))) inline __m256i AccumulateLanes4(__m256i acc, __m256i secret,
+                                                                 const unsigned char* data) {
+    __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    __m256i keyed = _mm256_xor_si256(value, secret);
+    __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+    __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm256_add_epi64(acc, _mm256_add_epi64(product, swapped));
+}
+
+__attribute__((target("avx2"))) inline void AccumulateAvx2(uint64_t* accumulators,
+                                                           const unsigned char* data,
+                                                           size_t length, uint64_t seed) {
+    constexpr size_t kVectors = kStripeSize / sizeof(__m256i);
+    const auto plus = static_cast<int64_t>(seed), minus = static_cast<int64_t>(-seed);
+    const __m256i seeds = _mm256_set_epi64x(minus, plus, minus, plus);
+    __m256i acc[kVectors], secret[kVectors];
+    for (size_t i = 0; i < kVectors; ++i) {
+        acc[i] =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kInitialAccumulators) + i);
+        secret[i] = _mm256_add_epi64(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kStripeSecret) + i), seeds);
+    }
+    size_t stripes = (length - 1) / kStripeSize;
+    for (size_t stripe = 0; stripe < stripes; ++stripe) {
+        for (size_t i = 0; i < kVectors; ++i) {
+            acc[i] = AccumulateLanes4(acc[i], secret[i],
+                                      data + stripe * kStripeSize + i * sizeof(__m256i));
+        }
+        if (stripe % kStripesPerBlock == kStripesPerBlock - 1) {
+            for (size_t i = 0; i < kVectors; ++i) {
+                acc[i] = ScrambleLanes4(acc[i], secret[i]);
+            }
+        }
+    }
+    for (size_t i = 0; i < kVectors; ++i) {
+        acc[i] = AccumulateLanes4(acc[i], secret[i],
+                                  data + length - kStripeSize + i * sizeof(__m256i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(accumulators) + i, acc[i]);
+    }
+}
+
+// GCC 12 reports the undefined pass-through operands inside its own AVX-512 intrinsics as
+// uninitialized.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f"))) inline __m512i AccumulateLanes8(__m512i acc, __m512i secret,
+                                                                    const unsigned char* data) {
+    __m512i value = _mm512_loadu_si512(data);
+    __m512i keyed = _mm512_xor_si512(value, secret);
+    __m512i product = _mm512_mul_epu32(keyed, _mm512_srli_epi64(keyed, 32));
+    __m512i swapped = _mm512_shuffle_epi32(value, _MM_PERM_BADC);
+    return _mm512_add_epi64(acc, _mm512_add_epi64(product, swapped));
+}
+
+__attribute__((target("avx512f"))) inline void AccumulateAvx512(uint64_t* accumulators,
+                                                                const unsigned char* data,
+                                                                size_t length, uint64_t seed) {
+    const auto plus = static_cast<int64_t>(seed), minus = static_cast<int64_t>(-seed);
+    const __m512i secret =
+        _mm512_add_epi64(_mm512_loadu_si512(kStripeSecret),
+                         _mm512_set_epi64(minus, plus, minus, plus, minus, plus, minus, plus));
+    const __m512i factor = _mm512_set1_epi64(kScrambleFactor);
+    __m512i acc = _mm512_loadu_si512(kInitialAccumulators);
+    size_t stripes = (length - 1) / kStripeSize;
+    for (size_t stripe = 0; stripe < stripes; ++stripe) {
+        acc = AccumulateLanes8(acc, secret, data + stripe * kStripeSize);
+        if (stripe % kStripesPerBlock == kStripesPerBlock - 1) {
+            acc = _mm512_xor_si512(_mm512_xor_si512(acc, _mm512_srli_epi64(acc, 47)), secret);
+            acc = _mm512_add_epi64(
+                _mm512_mul_epu32(acc, factor),
+                _mm512_slli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(acc, 32), factor), 32));
+        }
+    }
+    acc = AccumulateLanes8(acc, secret, data + length - kStripeSize);
+    _mm512_storeu_si512(accumulators, acc);
+}
+#pragma GCC diagnostic pop
+#endif
+
+using AccumulateKernel = void (*)(uint64_t*, const unsigned char*, size_t, uint64_t);
+
+inline AccumulateKernel SelectAccumulate(SimdLevel level) {
+#ifdef CPU_DISPATCH_X86
+    return cpu_dispatch::SelectKernel<AccumulateKernel>(
+        {AccumulateScalar<unsigned char>, AccumulateSse2, AccumulateAvx2, AccumulateAvx512},
+        level);
+#else
+    return cpu_dispatch::SelectKernel<AccumulateKernel>({AccumulateScalar<unsigned char>}, level);
+#endif
+}
+
+inline AccumulateKernel ActiveAccumulate() {
+    static const AccumulateKernel accumulate = SelectAccumulate(cpu_dispatch::ActiveSimdLevel());
+    return accumulate;
+}
+
+template <class Byte, class Kernel>
+constexpr uint64_t HashLong(const Byte* data, size_t length, uint64_t seed, Kernel accumulate) {
+    uint64_t accumulators[kLanes];
+    accumulate(accumulators, data, length, seed);
+    uint64_t result = length * kSecret[0];
+    for (size_t lane = 0; lane < kLanes; lane += 2) {
+        result += Mum(accumulators[lane] ^ kMergeSecret[lane],
+                      accumulators[lane + 1] ^ kMergeSecret[lane + 1]);
+    }
+    return Mum(result ^ kSecret[1], kSecret[2]);
+}
+
+constexpr uint64_t Hash(std::string_view bytes, uint64_t seed = 0) {
+    if (std::is_constant_evaluated()) {
+        return bytes.size() <= kShortLength
+                   ? HashShort(bytes.data(), bytes.size(), seed)
+                   : HashLong(bytes.data(), bytes.size(), seed, AccumulateScalar<char>);
+    }
+    const auto* data = reinterpret_cast<const unsigned char*>(bytes.data());
+    if (bytes.size() <= kShortLength) {
+        return HashShort(data, bytes.size(), seed);
+    }
+    return HashLong(data, bytes.size(), seed, ActiveAccumulate());
+}
+}  // namespace string_hash
+
+// Default hash of string keys in HashMap. It accepts anything convertible to std::string_view,
+// so heterogeneous lookups hash a std::string and its view alike, and it already avalanches, so
+// HashMap applies no finalizer. HashMap calls the seeded overload with the seed of its table.
+struct StringHash {
+    using is_avalanching = void;
+    using is_transparent = void;
+
+    constexpr size_t operator()(std::string_view bytes) const noexcept {
+        return static_cast<size_t>(string_hash::Hash(bytes));
+    }
+
+    constexpr size_t operator()(std::string_view bytes, uint64_t seed) const noexcept {
+        return static_cast<size_t>(string_hash::Hash(bytes, seed));
+    }
+};
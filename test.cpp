@@ -1,6 +1,23 @@
 #include "hash_map.h"
+#include "concurrent_hash_map.h"
+#include "cpu_dispatch.h"
+#include "frozen_hash_map.h"
+#include "hopscotch_hash_map.h"
+#include "huge_page_allocator.h"
+#include "left_right_hash_map.h"
+#include "probe_kernels.h"
+#include "seqlock_hash_map.h"
+#include "sharded_hash_map.h"
+#include "sip_hash.h"
+#include "string_hash.h"
 #include <catch.hpp>
 #include <iostream>
+#include <list>
+#include <memory_resource>
+#include <optional>
+#include <set>
+#include <thread>
+#include <unordered_set>
 
 namespace test_utils {
 struct StrangeInt {
@@ -86,6 +103,31 @@ struct IntWithError {
     int x;
 };
 
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream) : upstream_(upstream) {
+    }
+
+    size_t allocated = 0, deallocated = 0;
+
+private:
+    std::pmr::memory_resource* upstream_;
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        allocated += bytes;
+        return upstream_->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+        deallocated += bytes;
+        upstream_->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
 size_t StupidHash(int) {
     return 0;
 }
@@ -146,6 +188,11 @@ bool CmpPair(const std::unordered_map<int, int>& a, const HashMap<int, int>& b,
     }
     return it->second == it2->second;
 }
+
+struct Quote {
+    int64_t bid;
+    int64_t ask;
+};
 }  // namespace test_utils
 
 namespace std {
@@ -261,6 +308,23 @@ TEST_CASE("Copy check") {
     second = second = first;
     REQUIRE(first.Find(0)->second == 5);
     REQUIRE(second[0] == 5);
+
+    // Moved-from maps are empty and fully usable.
+    HashMap<int, int> moved(std::move(first));
+    REQUIRE(moved.Size() == 2);
+    REQUIRE(first.Empty());
+    REQUIRE(first.Find(0) == first.end());
+    REQUIRE(first.begin() == first.end());
+    REQUIRE(first.Stats().size == 0);
+    REQUIRE(first.Freeze().Empty());
+    first[7] = 7;
+    REQUIRE(first.At(7) == 7);
+    third = std::move(moved);
+    REQUIRE(third.Size() == 2);
+    REQUIRE(moved.Size() == 0);
+    moved.Erase(0);
+    moved.Insert({1, 2});
+    REQUIRE(moved.At(1) == 2);
 }
 
 TEST_CASE("Iterators check") {
@@ -325,6 +389,1209 @@ TEST_CASE("Consistency check") {
     REQUIRE(mp.Find(1) != mp.end());
 }
 
+TEST_CASE("Tombstone check") {
+    HashMap<int, int> mp;
+    for (int i = 0; i < 10; ++i) {
+        mp[i] = i;
+    }
+    for (int i = 10; i < 100'000; ++i) {
+        mp.Erase(i - 10);
+        mp.Insert({i, i});
+        REQUIRE(mp.Size() == 10);
+    }
+    for (int i = 99'990; i < 100'000; ++i) {
+        REQUIRE(mp.At(i) == i);
+    }
+}
+
+TEST_CASE("Allocator check") {
+    using PmrMap = HashMap<int, std::pmr::string, std::hash<int>,
+                           std::pmr::polymorphic_allocator<std::pair<const int, std::pmr::string>>>;
+    std::pmr::monotonic_buffer_resource arena;
+    test_utils::CountingResource first_resource(&arena), second_resource(&arena);
+    {
+        PmrMap first(&first_resource);
+        for (int i = 0; i < 1000; ++i) {
+            first[i] = "a long string that does not fit into the small buffer";
+        }
+        REQUIRE(first.Find(999)->second.get_allocator().resource() == &first_resource);
+        REQUIRE(first_resource.allocated > 0);
+
+        PmrMap copy(first);
+        REQUIRE(copy.GetAllocator().resource() == std::pmr::get_default_resource());
+
+        PmrMap moved(std::move(first));
+        REQUIRE(moved.GetAllocator().resource() == &first_resource);
+        REQUIRE(moved.At(5) == copy.At(5));
+
+        PmrMap second(&second_resource);
+        second = std::move(moved);
+        REQUIRE(second.GetAllocator().resource() == &second_resource);
+        REQUIRE(second.Size() == 1000);
+        REQUIRE(second.Find(999)->second.get_allocator().resource() == &second_resource);
+
+        PmrMap third(&second_resource);
+        third[1] = "x";
+        third.Swap(second);
+        REQUIRE(third.Size() == 1000);
+        REQUIRE(second.Size() == 1);
+    }
+    REQUIRE(first_resource.allocated == first_resource.deallocated);
+    REQUIRE(second_resource.allocated == second_resource.deallocated);
+}
+
+TEST_CASE("Huge page allocator check") {
+    using HugePageMap =
+        HashMap<int, int, std::hash<int>, HugePageAllocator<std::pair<const int, int>>>;
+    HugePageMap mp(std::hash<int>(), HugePageAllocator<std::pair<const int, int>>(1 << 16));
+    for (int i = 0; i < 100'000; ++i) {
+        mp[i] = i;
+    }
+    HugePageMap copy(mp);
+    for (int i = 0; i < 100'000; i += 2) {
+        mp.Erase(i);
+    }
+    REQUIRE(mp.Size() == 50'000);
+    REQUIRE(mp.At(99'999) == 99'999);
+    REQUIRE(copy.At(0) == 0);
+    mp.Clear();
+    REQUIRE(mp.Empty());
+    REQUIRE(mp.GetAllocator().Threshold() == 1 << 16);
+}
+
+TEST_CASE("In-place growth check") {
+    using HugePageMap = HashMap<uint64_t, uint64_t, std::hash<uint64_t>,
+                                HugePageAllocator<std::pair<const uint64_t, uint64_t>>>;
+    HugePageMap mp(std::hash<uint64_t>(),
+                   HugePageAllocator<std::pair<const uint64_t, uint64_t>>(1 << 12));
+    std::unordered_map<uint64_t, uint64_t> expected;
+    for (uint64_t i = 0; i < 300'000; ++i) {
+        uint64_t key = test_utils::rnd();
+        mp[key] = i;
+        expected[key] = i;
+        if (i % 3 == 0) {
+            mp.Erase(key);
+            expected.erase(key);
+        }
+    }
+    REQUIRE(mp.Size() == expected.size());
+    for (const auto& [key, value] : expected) {
+        REQUIRE(mp.At(key) == value);
+    }
+}
+
+namespace test_utils {
+// Runs the parallel paths of HashMap on threads_count threads, whatever the host has.
+struct ScopedThreadCount {
+    explicit ScopedThreadCount(size_t threads_count) {
+        hash_map_parallel::SetThreadCount(threads_count);
+    }
+    ~ScopedThreadCount() {
+        hash_map_parallel::SetThreadCount(0);
+    }
+};
+}  // namespace test_utils
+
+TEST_CASE("Parallel rebuild check") {
+    test_utils::ScopedThreadCount threads(4);
+    const int keys = (1 << 21) + 1'000;
+    HashMap<int, int> mp;
+    for (int key = 0; key < keys; ++key) {
+        mp.Insert({key * 7, key});
+    }
+    // The table holds at least 2^22 slots by now; outgrowing it reinserts them in parallel.
+    size_t capacity = mp.Stats().capacity;
+    REQUIRE(capacity >= (size_t{1} << 22));
+    mp.Reserve(capacity / 2 + 1);
+    REQUIRE(mp.Stats().capacity > capacity);
+    REQUIRE(mp.Size() == keys);
+    size_t iterated = 0;
+    for (auto [key, value] : mp) {
+        REQUIRE(key == value * 7);
+        ++iterated;
+    }
+    REQUIRE(iterated == keys);
+    for (int key = 0; key < keys; ++key) {
+        REQUIRE(mp.At(key * 7) == key);
+    }
+    REQUIRE(mp.Find(3) == mp.end());
+}
+
+TEST_CASE("Bulk build check") {
+    const int keys = 100'000, copies = 3;
+    std::vector<std::pair<int, int>> items;
+    for (int copy = 0; copy < copies; ++copy) {
+        for (int key = 0; key < keys; ++key) {
+            items.push_back({key * 3, copy});
+        }
+    }
+    std::shuffle(items.begin(), items.begin() + keys, test_utils::rnd);
+    using Map = HashMap<int, int>;
+    for (size_t threads_count : {1, 4}) {
+        test_utils::ScopedThreadCount threads(threads_count);
+        Map first = Map::BulkBuild(items.begin(), items.end());
+        Map last = Map::BulkBuild(items.begin(), items.end(), Map::DuplicatePolicy::kLastWins);
+        REQUIRE(first.Size() == keys);
+        REQUIRE(last.Size() == keys);
+        for (int key = 0; key < keys; ++key) {
+            REQUIRE(first.At(key * 3) == 0);
+            REQUIRE(last.At(key * 3) == copies - 1);
+            REQUIRE(first.Find(key * 3 + 1) == first.end());
+        }
+        first.Insert({1, 1});
+        REQUIRE(first.Size() == keys + 1);
+    }
+
+    const std::vector<std::pair<const int, std::string>> strings = {{1, "a"}, {2, "b"}, {1, "c"}};
+    auto small = HashMap<int, std::string>::BulkBuild(
+        strings.begin(), strings.end(), HashMap<int, std::string>::DuplicatePolicy::kLastWins);
+    REQUIRE(small.Size() == 2);
+    REQUIRE(small.At(1) == "c");
+}
+
+TEST_CASE("Batch lookup check") {
+    HashMap<int, int> mp;
+    std::vector<int> keys;
+    for (int key = 0; key < 1'000; ++key) {
+        mp[key * 2] = key;
+        keys.push_back(key);
+    }
+    std::vector<HashMap<int, int>::iterator> found(keys.size());
+    mp.FindBatch(keys, found);
+    std::unique_ptr<bool[]> contains(new bool[keys.size()]);
+    mp.ContainsBatch(keys, std::span(contains.get(), keys.size()));
+    for (size_t i = 0; i < keys.size(); ++i) {
+        REQUIRE(found[i] == mp.Find(keys[i]));
+        REQUIRE(contains[i] == (keys[i] % 2 == 0));
+    }
+    found[0]->second = -1;
+    REQUIRE(mp.At(0) == -1);
+
+    const HashMap<int, int>& const_mp = mp;
+    std::vector<HashMap<int, int>::const_iterator> const_found(2);
+    const_mp.FindBatch(std::vector<int>{4, 5}, const_found);
+    REQUIRE(const_found[0]->second == 2);
+    REQUIRE(const_found[1] == const_mp.end());
+    REQUIRE_THROWS_AS(mp.FindBatch(keys, std::span(found).first(1)), std::invalid_argument);
+}
+
+TEST_CASE("Interleaved lookup check") {
+    auto weak_hash = [](int key) -> size_t { return key % 7; };
+    HashMap<int, int, decltype(weak_hash)> mp(weak_hash);
+    std::vector<int> keys;
+    for (int key = 0; key < 500; ++key) {
+        if (key % 3 != 0) {
+            mp[key] = -key;
+        }
+        keys.push_back(key);
+    }
+    mp.Erase(4);
+    std::vector<decltype(mp)::iterator> found(keys.size());
+    mp.FindInterleaved(keys, found);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        REQUIRE(found[i] == mp.Find(keys[i]));
+    }
+    found[1]->second = 1;
+    REQUIRE(mp.At(1) == 1);
+
+    const auto& const_mp = mp;
+    std::vector<decltype(mp)::const_iterator> const_found(1);
+    const_mp.FindInterleaved(std::vector<int>{2}, const_found);
+    REQUIRE(const_found[0]->second == -2);
+    mp.FindInterleaved({}, found);
+    REQUIRE_THROWS_AS(mp.FindInterleaved(keys, std::span(found).first(1)), std::invalid_argument);
+}
+
+TEST_CASE("Batch insert check") {
+    HashMap<int, int> mp;
+    std::unordered_map<int, int> expected;
+    for (int batch = 0; batch < 20; ++batch) {
+        std::vector<std::pair<int, int>> items;
+        for (int i = 0; i < 1'000; ++i) {
+            items.push_back({test_utils::Get(-5'000, 5'000), batch});
+        }
+        for (const auto& item : items) {
+            expected.insert(item);
+        }
+        mp.InsertBatch(items);
+        for (int i = 0; i < 300; ++i) {
+            int key = test_utils::Get(-5'000, 5'000);
+            expected.erase(key);
+            mp.Erase(key);
+        }
+        REQUIRE(test_utils::CmpElements(expected, mp));
+    }
+    const std::list<std::pair<const int, int>> list = {{1, 1}, {2, 2}, {1, 3}};
+    HashMap<int, int> small;
+    small.InsertBatch(list);
+    REQUIRE(small.Size() == 2);
+    REQUIRE(small.At(1) == 1);
+    small.InsertBatch(std::vector<std::pair<int, int>>());
+    REQUIRE(small.Size() == 2);
+}
+
+TEST_CASE("CPU dispatch check") {
+    SimdLevel detected = cpu_dispatch::DetectSimdLevel();
+    REQUIRE(cpu_dispatch::ActiveSimdLevel() <= detected);
+#ifdef CPU_DISPATCH_X86
+    REQUIRE((detected >= SimdLevel::kAvx2) == static_cast<bool>(__builtin_cpu_supports("avx2")));
+    REQUIRE((detected == SimdLevel::kAvx512) ==
+            static_cast<bool>(__builtin_cpu_supports("avx512f")));
+#endif
+    REQUIRE(cpu_dispatch::ParseSimdLevel("scalar") == SimdLevel::kScalar);
+    REQUIRE(cpu_dispatch::ParseSimdLevel("sse2") == SimdLevel::kSse2);
+    REQUIRE(cpu_dispatch::ParseSimdLevel("avx2") == SimdLevel::kAvx2);
+    REQUIRE(cpu_dispatch::ParseSimdLevel("avx512") == SimdLevel::kAvx512);
+    REQUIRE(cpu_dispatch::ParseSimdLevel("unknown") == SimdLevel::kAvx512);
+
+    using Kernel = int (*)();
+    Kernel scalar = [] { return 0; }, avx2 = [] { return 2; };
+    auto select = [&](SimdLevel level) {
+        return cpu_dispatch::SelectKernel<Kernel>({scalar, nullptr, avx2}, level)();
+    };
+    REQUIRE(select(SimdLevel::kScalar) == 0);
+    REQUIRE(select(SimdLevel::kSse2) == 0);
+    REQUIRE(select(SimdLevel::kAvx2) == 2);
+    REQUIRE(select(SimdLevel::kAvx512) == 2);
+}
+
+namespace test_utils {
+struct AvalanchingHash {
+    using is_avalanching = void;
+
+    size_t operator()(int key) const {
+        return hash_mix::Fmix64()(key);
+    }
+};
+
+// Places every key at the bucket its value selects.
+struct IdentityAvalanchingHash {
+    using is_avalanching = void;
+
+    size_t operator()(uint64_t key) const {
+        return key;
+    }
+};
+
+// Claims to avalanche but leaves the low bits of every key zero.
+struct LowBitsDroppingHash {
+    using is_avalanching = void;
+
+    size_t operator()(int key) const {
+        return static_cast<size_t>(key) << 32;
+    }
+};
+
+template <class Mix>
+size_t DistinctLowBits(size_t count, size_t bits) {
+    std::vector<bool> seen(size_t{1} << bits);
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t low = Mix()(i << bits) & ((size_t{1} << bits) - 1);
+        distinct += !seen[low];
+        seen[low] = true;
+    }
+    return distinct;
+}
+}  // namespace test_utils
+
+TEST_CASE("Hash mix check") {
+    static_assert(is_avalanching_v<test_utils::AvalanchingHash>);
+    static_assert(!is_avalanching_v<std::hash<int>>);
+
+    // Multiples of 1024 share their low bits until a finalizer spreads the high ones.
+    const size_t count = 1'024, bits = 10;
+    REQUIRE(test_utils::DistinctLowBits<hash_mix::Identity>(count, bits) == 1);
+    REQUIRE(test_utils::DistinctLowBits<hash_mix::Fmix64>(count, bits) > count / 2);
+    REQUIRE(test_utils::DistinctLowBits<hash_mix::Fibonacci>(count, bits) > count / 2);
+    REQUIRE(test_utils::DistinctLowBits<hash_mix::Mum>(count, bits) > count / 2);
+
+    // The seed is XORed in before a finalizer, so it cannot leave such keys colliding either.
+    for (uint64_t seed : {uint64_t{0}, hash_mix::Fibonacci::kFactor}) {
+        std::vector<bool> seen(size_t{1} << bits);
+        size_t distinct = 0;
+        for (size_t i = 0; i < count; ++i) {
+            size_t low = hash_mix::SeededHash<hash_mix::Identity>(
+                             test_utils::LowBitsDroppingHash(), static_cast<int>(i), seed) &
+                         ((size_t{1} << bits) - 1);
+            distinct += !seen[low];
+            seen[low] = true;
+        }
+        REQUIRE(distinct > count / 2);
+    }
+
+    auto check = [&](auto mp) {
+        for (int i = 0; i < 10'000; ++i) {
+            mp[i * 1'024] = i;
+        }
+        REQUIRE(mp.Size() == 10'000);
+        for (int i = 0; i < 10'000; ++i) {
+            REQUIRE(mp.At(i * 1'024) == i);
+            REQUIRE(mp.Find(i * 1'024 + 1) == mp.end());
+        }
+    };
+    using Allocator = std::allocator<std::pair<const int, int>>;
+    check(HashMap<int, int>());
+    check(HashMap<int, int, std::hash<int>, Allocator, hash_mix::Identity>());
+    check(HashMap<int, int, std::hash<int>, Allocator, hash_mix::Fibonacci>());
+    check(HashMap<int, int, std::hash<int>, Allocator, hash_mix::Mum>());
+    check(HashMap<int, int, test_utils::AvalanchingHash>());
+    check(HashMap<int, int, test_utils::LowBitsDroppingHash>());
+    REQUIRE(HashMap<int, int>().HashFunction()(1'024) == 1'024);
+}
+
+TEST_CASE("String hash check") {
+    static_assert(std::is_same_v<decltype(HashMap<std::string, int>().HashFunction()), StringHash>);
+    static_assert(std::is_same_v<decltype(HashMap<int, int>().HashFunction()), std::hash<int>>);
+    static_assert(is_avalanching_v<StringHash>);
+
+    std::string text;
+    for (size_t i = 0; i < 3'000; ++i) {
+        text.push_back(static_cast<char>(test_utils::rnd()));
+    }
+    StringHash hash;
+    std::unordered_set<size_t> hashes;
+    size_t lengths = 0;
+    for (size_t length = 0; length <= text.size(); length += length < 300 ? 1 : 97, ++lengths) {
+        std::string_view bytes(text.data(), length);
+        REQUIRE(hash(std::string(bytes)) == hash(bytes));
+        hashes.insert(hash(bytes));
+        if (length > string_hash::kShortLength) {
+            const auto* data = reinterpret_cast<const unsigned char*>(bytes.data());
+            for (auto level : {SimdLevel::kScalar, SimdLevel::kSse2, SimdLevel::kAvx2,
+                               SimdLevel::kAvx512}) {
+                if (level <= cpu_dispatch::DetectSimdLevel()) {
+                    auto accumulate = string_hash::SelectAccumulate(level);
+                    REQUIRE(string_hash::HashLong(data, length, 0, accumulate) == hash(bytes));
+                    REQUIRE(string_hash::HashLong(data, length, 0x243f6a8885a308d3ULL,
+                                                  accumulate) ==
+                            hash(bytes, 0x243f6a8885a308d3ULL));
+                }
+            }
+        }
+    }
+    // Every prefix and every single flipped bit changes the hash.
+    std::string_view prefix(text.data(), 200);
+    for (size_t bit = 0; bit < prefix.size() * 8; ++bit) {
+        std::string flipped(prefix);
+        flipped[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+        hashes.insert(hash(flipped));
+    }
+    REQUIRE(hashes.size() == lengths + prefix.size() * 8);
+
+    HashMap<std::string, int> mp;
+    for (int i = 0; i < 10'000; ++i) {
+        mp["https://example.com/items/" + std::to_string(i)] = i;
+    }
+    for (int i = 0; i < 10'000; ++i) {
+        REQUIRE(mp.At("https://example.com/items/" + std::to_string(i)) == i);
+    }
+}
+
+namespace test_utils {
+// Records every seed it is called with, so that a test can play an attacker who learned the seed.
+struct SeedLeakingHash {
+    using is_avalanching = void;
+
+    std::shared_ptr<std::set<uint64_t>> seeds = std::make_shared<std::set<uint64_t>>();
+
+    size_t operator()(uint64_t key, uint64_t seed) const {
+        seeds->insert(seed);
+        return hash_mix::Fmix64()(key ^ seed);
+    }
+};
+
+uint64_t InverseFmix64(uint64_t hash) {
+    auto inverse = [](uint64_t factor) {
+        uint64_t result = factor;
+        for (int i = 0; i < 5; ++i) {
+            result *= 2 - factor * result;
+        }
+        return result;
+    };
+    hash ^= hash >> 33;
+    hash *= inverse(hash_mix::Fmix64::kSecondFactor);
+    hash ^= hash >> 33;
+    hash *= inverse(hash_mix::Fmix64::kFirstFactor);
+    hash ^= hash >> 33;
+    return hash;
+}
+}  // namespace test_utils
+
+TEST_CASE("Seeded hashing check") {
+    // Reference vectors of SipHash-2-4 with the key 00 01 ... 0f.
+    const uint64_t k0 = 0x0706050403020100ULL, k1 = 0x0f0e0d0c0b0a0908ULL;
+    std::string message;
+    for (char byte = 0; byte < 15; ++byte) {
+        message.push_back(byte);
+    }
+    REQUIRE(sip_hash::Hash<2, 4>("", k0, k1) == 0x726fdb47dd0e0e31ULL);
+    REQUIRE(sip_hash::Hash<2, 4>(message, k0, k1) == 0xa129ca6149be45e5ULL);
+
+    for (size_t length : {0, 3, 16, 64, 65, 1'000}) {
+        std::string bytes(length, 'a');
+        REQUIRE(StringHash()(bytes, 0) == StringHash()(bytes));
+        REQUIRE(StringHash()(bytes, 1) != StringHash()(bytes, 2));
+        REQUIRE(SipHash()(bytes, 1) != SipHash()(bytes, 2));
+    }
+    REQUIRE(SipHash()(42, 7) == SipHash()(42, 7));
+
+    // Every map draws its own seed, which orders its elements differently; copies keep it.
+    auto order = [](const auto& mp) {
+        std::vector<int> keys;
+        for (const auto& [key, value] : mp) {
+            keys.push_back(key);
+        }
+        return keys;
+    };
+    HashMap<int, int> first, second;
+    for (int i = 0; i < 1'000; ++i) {
+        first[i] = second[i] = i;
+    }
+    REQUIRE(order(first) != order(second));
+    HashMap<int, int> copy(first);
+    REQUIRE(order(copy) == order(first));
+    copy = second;
+    REQUIRE(order(copy) == order(second));
+
+    HashMap<std::string, int, SipHash> strings;
+    for (int i = 0; i < 1'000; ++i) {
+        strings[std::to_string(i)] = i;
+    }
+    for (int i = 0; i < 1'000; ++i) {
+        REQUIRE(strings.At(std::to_string(i)) == i);
+    }
+}
+
+TEST_CASE("Hash flooding check") {
+    // Keys crafted against the seed of the table share the low 32 bits of their hash, and hence
+    // the whole probe sequence; the table has to notice and reseed exactly once.
+    const size_t count = 2'000;
+    auto flood = [&](auto insert) {
+        test_utils::SeedLeakingHash hash;
+        HashMap<uint64_t, int, test_utils::SeedLeakingHash> mp(hash);
+        mp.Reserve(count);
+        mp[0] = 0;
+        REQUIRE(hash.seeds->size() == 1);
+        uint64_t seed = *hash.seeds->begin();
+        std::vector<std::pair<uint64_t, int>> items;
+        for (size_t i = 1; i <= count; ++i) {
+            items.emplace_back(test_utils::InverseFmix64((i << 32) | 0x5eed) ^ seed, i);
+        }
+        insert(mp, items);
+        REQUIRE(hash.seeds->size() == 2);
+        REQUIRE(mp.Size() == count + 1);
+        for (const auto& [key, value] : items) {
+            REQUIRE(mp.At(key) == value);
+        }
+    };
+    flood([](auto& mp, const auto& items) {
+        for (const auto& item : items) {
+            mp.Insert(item);
+        }
+    });
+    flood([](auto& mp, const auto& items) {
+        for (const auto& [key, value] : items) {
+            mp[key] = value;
+        }
+    });
+    flood([](auto& mp, const auto& items) { mp.InsertBatch(items); });
+}
+
+namespace test_utils {
+// Ignores the seed and sends every key to the same hash, like keys whose hashes collide before
+// any seed is applied.
+struct SeedlessCollidingHash {
+    size_t operator()(uint64_t) const {
+        return 0x5eed;
+    }
+};
+}  // namespace test_utils
+
+TEST_CASE("Seed-independent collisions check") {
+    // The first eight bytes of these keys once cancelled the secret of StringHash, which zeroed
+    // the product holding the seed, so keys with the same tail collided under every seed.
+    auto key = [](uint64_t i) {
+        std::string bytes(8, '\0');
+        for (size_t j = 0; j < 8; ++j) {
+            bytes[j] = static_cast<char>(string_hash::kSecret[1] >> (8 * j));
+        }
+        bytes.append(reinterpret_cast<const char*>(&i), sizeof(i));
+        return bytes + "/a-sixteen-bytes";
+    };
+    for (uint64_t seed : {0ULL, 1ULL, 0x123456789ULL}) {
+        REQUIRE(StringHash()(key(1), seed) != StringHash()(key(2), seed));
+    }
+    const size_t count = 4'000;
+    HashMap<std::string, int> strings;
+    for (size_t i = 0; i < count; ++i) {
+        strings[key(i)] = i;
+    }
+    REQUIRE(strings.Stats().max_probe_length < 20);
+    for (size_t i = 0; i < count; ++i) {
+        REQUIRE(strings.At(key(i)) == static_cast<int>(i));
+    }
+
+    // Reseeding cannot separate keys whose hashes are equal, so the table switches to SipHash.
+    HashMap<uint64_t, int, test_utils::SeedlessCollidingHash> mp;
+    for (size_t i = 0; i < count; ++i) {
+        mp[i * 7] = i;
+    }
+    REQUIRE(mp.Stats().max_probe_length < 20);
+    HashMap<uint64_t, int, test_utils::SeedlessCollidingHash> copy(mp);
+    copy.InsertBatch(std::vector<std::pair<uint64_t, int>>{{1, 1}, {2, 2}});
+    for (size_t i = 0; i < count; ++i) {
+        REQUIRE(mp.At(i * 7) == static_cast<int>(i));
+        REQUIRE(copy.At(i * 7) == static_cast<int>(i));
+    }
+    REQUIRE(copy.At(1) == 1);
+    REQUIRE(copy.Stats().max_probe_length < 20);
+}
+
+namespace test_utils {
+struct ConstantHash {
+    constexpr size_t operator()(int) const {
+        return 1;
+    }
+};
+
+constexpr auto kHeaderIds = MakeFrozenHashMap<std::string_view, int>({
+    {"host", 1},
+    {"accept", 2},
+    {"accept-encoding", 3},
+    {"content-type", 4},
+    {"content-length", 5},
+    {"cookie", 6},
+    {"user-agent", 7},
+    {"x-a-header-name-that-is-well-beyond-the-sixty-four-bytes-of-a-short-key", 8},
+    {"", 9},
+});
+}  // namespace test_utils
+
+TEST_CASE("Frozen hash map check") {
+    using test_utils::kHeaderIds;
+    static_assert(kHeaderIds.Size() == 9);
+    static_assert(kHeaderIds.At("cookie") == 6);
+    static_assert(kHeaderIds.At("") == 9);
+    static_assert(kHeaderIds.Find("referer") == kHeaderIds.end());
+    static_assert(
+        kHeaderIds.At("x-a-header-name-that-is-well-beyond-the-sixty-four-bytes-of-a-short-key") ==
+        8);
+    // The layout computed at compile time must agree with hashing at run time.
+    for (const auto& [name, id] : kHeaderIds) {
+        REQUIRE(kHeaderIds.At(std::string(name)) == id);
+    }
+    REQUIRE(kHeaderIds.Find(std::string("accept-language")) == kHeaderIds.end());
+    REQUIRE_THROWS_AS(kHeaderIds.At("referer"), std::out_of_range);
+
+    const size_t count = 10'000;
+    std::vector<std::pair<int64_t, int>> items;
+    std::unordered_set<int64_t> keys;
+    while (items.size() < count) {
+        int64_t key = static_cast<int64_t>(test_utils::rnd());
+        if (keys.insert(key).second) {
+            items.emplace_back(key, static_cast<int>(items.size()));
+        }
+    }
+    const FrozenHashMap<int64_t, int, count> mp(
+        std::span<const std::pair<int64_t, int>, count>(items.data(), count));
+    for (const auto& [key, value] : items) {
+        REQUIRE(mp.At(key) == value);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        int64_t key = static_cast<int64_t>(test_utils::rnd());
+        REQUIRE((mp.Find(key) == mp.end()) == !keys.contains(key));
+    }
+    REQUIRE(std::distance(mp.begin(), mp.end()) == static_cast<ptrdiff_t>(count));
+
+    REQUIRE_THROWS_AS((MakeFrozenHashMap<int, int>({{1, 1}, {2, 2}, {1, 3}})),
+                      std::invalid_argument);
+    REQUIRE_THROWS_AS((MakeFrozenHashMap<int, int>({{1, 1}, {2, 2}}, test_utils::ConstantHash())),
+                      std::invalid_argument);
+}
+
+TEST_CASE("Freeze check") {
+    HashMap<int, int> mp;
+    for (int i = 0; i < 100'000; ++i) {
+        mp[i * 1'024] = i;
+    }
+    for (int i = 0; i < 100'000; i += 3) {
+        mp.Erase(i * 1'024);
+    }
+    auto frozen = mp.Freeze();
+    REQUIRE(frozen.Size() == mp.Size());
+    for (int i = 0; i < 100'000; ++i) {
+        REQUIRE((frozen.Find(i * 1'024) == frozen.end()) == (i % 3 == 0));
+        REQUIRE(frozen.Find(i * 1'024 + 1) == frozen.end());
+    }
+    size_t sum = 0;
+    for (const auto& [key, value] : frozen) {
+        REQUIRE(mp.At(key) == value);
+        sum += value;
+    }
+    size_t expected = 0;
+    for (const auto& [key, value] : mp) {
+        expected += value;
+    }
+    REQUIRE(sum == expected);
+    REQUIRE_THROWS_AS(frozen.At(1), std::out_of_range);
+
+    HashMap<std::string, std::string> strings;
+    for (int i = 0; i < 1'000; ++i) {
+        strings[std::to_string(i)] = std::to_string(-i);
+    }
+    auto frozen_strings = strings.Freeze();
+    for (int i = 0; i < 1'000; ++i) {
+        REQUIRE(frozen_strings.At(std::to_string(i)) == std::to_string(-i));
+    }
+
+    auto empty = HashMap<int, int>().Freeze();
+    REQUIRE(empty.Empty());
+    REQUIRE(empty.Find(0) == empty.end());
+
+    HashMap<int, int, test_utils::ConstantHash> colliding;
+    colliding[1] = 1;
+    colliding[2] = 2;
+    REQUIRE_THROWS_AS(colliding.Freeze(), std::invalid_argument);
+
+    // Keys with equal hashes get a table that switched to SipHash, and so does its snapshot.
+    HashMap<uint64_t, int, test_utils::SeedlessCollidingHash> switched;
+    for (uint64_t i = 0; i < 10'000; ++i) {
+        switched[i * 7] = i;
+    }
+    REQUIRE(switched.Stats().max_probe_length < 20);
+    auto frozen_switched = switched.Freeze();
+    REQUIRE(frozen_switched.Size() == switched.Size());
+    for (uint64_t i = 0; i < 10'000; ++i) {
+        REQUIRE(frozen_switched.At(i * 7) == static_cast<int>(i));
+        REQUIRE(frozen_switched.Find(i * 7 + 1) == frozen_switched.end());
+    }
+}
+
+namespace test_utils {
+// Gives the keys below 64 one hash, and with it one home group and stride, so they fill a chain of
+// about ten groups; other keys keep their own hashes.
+struct ChainedBelow64Hash {
+    size_t operator()(int key) const {
+        return key < 64 ? 0 : static_cast<size_t>(key);
+    }
+};
+}  // namespace test_utils
+
+TEST_CASE("Stats check") {
+    HashMap<int, int> mp;
+    HashMapStats stats = mp.Stats();
+    REQUIRE(stats.size == 0);
+    REQUIRE(stats.capacity > 0);
+    REQUIRE(stats.average_probe_length == 0);
+    REQUIRE(stats.max_probe_length == 0);
+    REQUIRE(stats.probe_length_histogram.empty());
+
+    std::mt19937 gen(42);
+    std::vector<int> keys;
+    for (int i = 0; i < 100'000; ++i) {
+        keys.push_back(static_cast<int>(gen()));
+        mp[keys.back()] = i;
+    }
+    std::vector<int> erased(keys.begin(), keys.begin() + keys.size() / 3);
+    std::sort(erased.begin(), erased.end());
+    erased.erase(std::unique(erased.begin(), erased.end()), erased.end());
+    for (int key : erased) {
+        mp.Erase(key);
+    }
+    stats = mp.Stats();
+    REQUIRE(stats.size == mp.Size());
+    REQUIRE(stats.capacity >= 2 * stats.size);
+    REQUIRE(stats.tombstones == erased.size());
+    size_t total = 0, weighted = 0;
+    for (size_t i = 0; i < stats.probe_length_histogram.size(); ++i) {
+        total += stats.probe_length_histogram[i];
+        weighted += (i + 1) * stats.probe_length_histogram[i];
+    }
+    REQUIRE(total == stats.size);
+    REQUIRE(stats.probe_length_histogram.size() == stats.max_probe_length);
+    REQUIRE(stats.probe_length_histogram.back() > 0);
+    REQUIRE(stats.average_probe_length == static_cast<double>(weighted) / stats.size);
+    REQUIRE(stats.average_probe_length < 2);
+    REQUIRE(stats.keys_in_long_clusters == 0);
+
+    HashMap<int, int, test_utils::ChainedBelow64Hash> clustered;
+    clustered.Reserve(1'024);
+    for (int i = 0; i < 1'024; ++i) {
+        clustered[i] = i;
+    }
+    stats = clustered.Stats();
+    REQUIRE(stats.size == 1'024);
+    REQUIRE(stats.max_probe_length >= HashMapStats::kLongClusterGroups);
+    REQUIRE(stats.keys_in_long_clusters >= 64);
+    REQUIRE(stats.keys_in_long_clusters < 128);
+}
+
+TEST_CASE("Probe kernels check") {
+    const std::array<size_t, 3> factors = {239, 179, 191};
+    const size_t count = 1'003;
+    std::vector<int64_t> keys(count);
+    for (auto& key : keys) {
+        key = static_cast<int64_t>(test_utils::rnd()) * test_utils::Get(-1'000, 1'000);
+    }
+    std::vector<int32_t> narrow_keys(keys.begin(), keys.end());
+    std::vector<uint32_t> unsigned_keys(keys.begin(), keys.end());
+    for (auto [mask, seed] : {std::pair<uint32_t, uint64_t>{0u, 0}, {7u, 0x243f6a8885a308d3ULL},
+                              {(1u << 20) - 1, 0}, {(1u << 20) - 1, 0x13198a2e03707344ULL},
+                              {UINT32_MAX, 0xa4093822299f31d0ULL}}) {
+        std::vector<size_t> groups(count), strides(count), expected_groups(count),
+            expected_strides(count);
+        auto check = [&]<class Mix>(Mix mix, auto kernel, const auto& source) {
+            for (size_t i = 0; i < count; ++i) {
+                size_t hash =
+                    mix(std::hash<std::decay_t<decltype(source[i])>>()(source[i]) ^ seed);
+                size_t stride = 0;
+                for (size_t factor : factors) {
+                    stride = (stride * hash + factor) & mask;
+                }
+                expected_groups[i] = hash & mask;
+                expected_strides[i] = stride | 1;
+            }
+            kernel(source.data(), count, mask, seed, factors, groups.data(), strides.data());
+            REQUIRE(groups == expected_groups);
+            REQUIRE(strides == expected_strides);
+        };
+        auto check_mix = [&]<class Mix>(Mix mix) {
+            check(mix, probe_kernels::ProbeStarts<int64_t, Mix>, keys);
+            check(mix, probe_kernels::ProbeStarts<int32_t, Mix>, narrow_keys);
+            check(mix, probe_kernels::ProbeStarts<uint32_t, Mix>, unsigned_keys);
+            for (auto level : {SimdLevel::kScalar, SimdLevel::kSse2, SimdLevel::kAvx2,
+                               SimdLevel::kAvx512}) {
+                if (level <= cpu_dispatch::DetectSimdLevel()) {
+                    check(mix, probe_kernels::SelectProbeStarts<int64_t, Mix>(level), keys);
+                    check(mix, probe_kernels::SelectProbeStarts<int32_t, Mix>(level),
+                          narrow_keys);
+                    check(mix, probe_kernels::SelectProbeStarts<uint32_t, Mix>(level),
+                          unsigned_keys);
+                }
+            }
+        };
+        check_mix(hash_mix::Identity());
+        check_mix(hash_mix::Fmix64());
+        check_mix(hash_mix::Fibonacci());
+    }
+
+    HashMap<int64_t, int64_t> mp;
+    for (int64_t key : keys) {
+        mp[key] = -key;
+    }
+    std::vector<HashMap<int64_t, int64_t>::iterator> found(count);
+    mp.FindBatch(keys, found);
+    for (size_t i = 0; i < count; ++i) {
+        REQUIRE(found[i]->second == -keys[i]);
+    }
+}
+
+TEST_CASE("Sharded map check") {
+    ShardedHashMap<int, int> mp;
+    REQUIRE(mp.Insert({1, 2}));
+    REQUIRE(!mp.Insert({1, 3}));
+    int value = 0;
+    REQUIRE(mp.Find(1, [&](int found) { value = found; }));
+    REQUIRE(value == 2);
+    REQUIRE(mp.Erase(1));
+    REQUIRE(!mp.Contains(1));
+
+    const int threads_count = 4, keys = 1000, rounds = 20;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < threads_count; ++thread) {
+        threads.emplace_back([&mp] {
+            for (int round = 0; round < rounds; ++round) {
+                for (int key = 0; key < keys; ++key) {
+                    mp.Upsert(key, [](int& counter) { ++counter; });
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(mp.Size() == keys);
+    for (int key = 0; key < keys; ++key) {
+        REQUIRE(mp.Find(key, [](int counter) { REQUIRE(counter == threads_count * rounds); }));
+    }
+}
+
+TEST_CASE("Concurrent map check") {
+    ConcurrentHashMap<int, std::string> mp;
+    REQUIRE(mp.Insert({1, "one"}));
+    REQUIRE(!mp.Insert({1, "uno"}));
+    std::string value;
+    REQUIRE(mp.Find(1, [&](const std::string& found) { value = found; }));
+    REQUIRE(value == "one");
+    REQUIRE(mp.Erase(1));
+    REQUIRE(!mp.Erase(1));
+    REQUIRE(mp.Empty());
+
+    const int writers = 3, readers = 3, keys = 20'000;
+    std::atomic<bool> done = false;
+    std::atomic<int> mismatches = 0;
+    std::vector<std::thread> threads;
+    for (int writer = 0; writer < writers; ++writer) {
+        threads.emplace_back([&mp, writer] {
+            for (int key = writer; key < keys; key += writers) {
+                mp.Insert({key, std::to_string(key)});
+                if (key % 4 == 0) {
+                    mp.Erase(key);
+                }
+            }
+        });
+    }
+    for (int reader = 0; reader < readers; ++reader) {
+        threads.emplace_back([&, reader] {
+            std::mt19937 rnd(reader);
+            while (!done) {
+                int key = rnd() % keys;
+                mp.Find(key, [&](const std::string& found) {
+                    if (found != std::to_string(key)) {
+                        ++mismatches;
+                    }
+                });
+            }
+        });
+    }
+    for (int writer = 0; writer < writers; ++writer) {
+        threads[writer].join();
+    }
+    done = true;
+    for (int reader = 0; reader < readers; ++reader) {
+        threads[writers + reader].join();
+    }
+    REQUIRE(mismatches == 0);
+    REQUIRE(mp.Size() == keys - keys / 4);
+    for (int key = 0; key < keys; ++key) {
+        REQUIRE(mp.Contains(key) == (key % 4 != 0));
+    }
+}
+
+namespace test_utils {
+// Its copy constructor throws once copies_left copies have been made; a negative budget never
+// runs out.
+struct CopyBudget {
+    static int copies_left;
+
+    int x = 0;
+
+    CopyBudget() = default;
+    CopyBudget(int x) : x(x) {
+    }
+    CopyBudget(const CopyBudget& other) : x(other.x) {
+        if (copies_left >= 0 && copies_left-- == 0) {
+            throw std::runtime_error("copy budget exhausted");
+        }
+    }
+    CopyBudget& operator=(const CopyBudget&) = default;
+};
+
+int CopyBudget::copies_left = -1;
+}  // namespace test_utils
+
+TEST_CASE("Concurrent transfer exception check") {
+    // Two insertions out of three may copy one pair only, so a transfer they help with throws
+    // midway and leaves its chunk to the next insertion.
+    ConcurrentHashMap<int, test_utils::CopyBudget> mp;
+    std::vector<int> inserted;
+    int failures = 0;
+    for (int key = 0; key < 5'000; ++key) {
+        test_utils::CopyBudget::copies_left = key % 3 == 0 ? -1 : 1;
+        try {
+            if (mp.Insert({key, key})) {
+                inserted.push_back(key);
+            }
+        } catch (const std::runtime_error&) {
+            ++failures;
+        }
+    }
+    test_utils::CopyBudget::copies_left = -1;
+    REQUIRE(failures > 0);
+    REQUIRE(mp.Size() == inserted.size());
+    for (int key : inserted) {
+        int value = -1;
+        REQUIRE(mp.Find(key, [&](const test_utils::CopyBudget& found) { value = found.x; }));
+        REQUIRE(value == key);
+    }
+}
+
+TEST_CASE("Concurrent strided keys check") {
+    // The identity std::hash sends multiples of a large power of two to one home slot unless the
+    // hash is finalized.
+    ConcurrentHashMap<uint64_t, int> mp;
+    const int keys = 100'000;
+    for (int key = 0; key < keys; ++key) {
+        REQUIRE(mp.Insert({static_cast<uint64_t>(key) << 20, key}));
+    }
+    for (int key = 0; key < keys; key += 7) {
+        int value = -1;
+        REQUIRE(mp.Find(static_cast<uint64_t>(key) << 20, [&](int found) { value = found; }));
+        REQUIRE(value == key);
+        REQUIRE(!mp.Contains((static_cast<uint64_t>(key) << 20) + 1));
+    }
+    REQUIRE(mp.Erase(uint64_t{5} << 20));
+    REQUIRE(!mp.Erase(uint64_t{5} << 20));
+    REQUIRE(mp.Size() == keys - 1);
+}
+
+TEST_CASE("Concurrent resize check") {
+    ConcurrentHashMap<int, int> mp;
+    const int writers = 4, keys = 200'000;
+    std::atomic<int> published = 0, lost = 0;
+    std::vector<std::thread> threads;
+    for (int writer = 0; writer < writers; ++writer) {
+        threads.emplace_back([&, writer] {
+            for (int key = writer; key < keys; key += writers) {
+                mp.Insert({key, key});
+                if (!mp.Contains(key)) {
+                    ++lost;
+                }
+                if (key % 3 == 0) {
+                    mp.Erase(key);
+                }
+                if (writer == 0) {
+                    published = key;
+                }
+            }
+        });
+    }
+    threads.emplace_back([&] {
+        std::mt19937 rnd(writers);
+        while (published < keys - writers) {
+            int key = published.load();
+            key -= key % writers + (rnd() % 16) * writers;
+            if (key >= 0 && key % 3 != 0 && !mp.Contains(key)) {
+                ++lost;
+            }
+        }
+    });
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(lost == 0);
+    REQUIRE(mp.Size() == keys - (keys + 2) / 3);
+    for (int key = 0; key < keys; ++key) {
+        REQUIRE(mp.Contains(key) == (key % 3 != 0));
+    }
+}
+
+TEST_CASE("Concurrent builder check") {
+    const int threads_count = 4, keys = 50'000;
+    HashMap<int, int>::ConcurrentBuilder builder(keys);
+    std::atomic<int> inserted = 0;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < threads_count; ++thread) {
+        threads.emplace_back([&builder, &inserted, thread] {
+            for (int key = thread * keys / (2 * threads_count); key < keys; key += 2) {
+                inserted += builder.Insert({key, key * 2});
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(inserted == keys / 2);
+    HashMap<int, int> mp = std::move(builder).Seal();
+    REQUIRE(mp.Size() == keys / 2);
+    for (int key = 0; key < keys; ++key) {
+        REQUIRE((mp.Find(key) != mp.end()) == (key % 2 == 0));
+    }
+    mp[keys + 1] = 1;
+    REQUIRE(mp.At(keys - 2) == 2 * (keys - 2));
+
+    HashMap<int, int>::ConcurrentBuilder small(1);
+    REQUIRE(small.Insert({1, 1}));
+    REQUIRE_THROWS_AS(small.Insert({2, 2}), std::length_error);
+}
+
+TEST_CASE("Seqlock map check") {
+    SeqlockHashMap<int, test_utils::Quote> mp;
+    REQUIRE(mp.Insert({1, {10, 11}}));
+    REQUIRE(!mp.Insert({1, {20, 21}}));
+    test_utils::Quote quote;
+    REQUIRE(mp.Find(1, quote));
+    REQUIRE(quote.bid == 10);
+    mp.Assign(1, {30, 31});
+    REQUIRE(mp.Find(1, quote));
+    REQUIRE(quote.ask == 31);
+    REQUIRE(mp.Erase(1));
+    REQUIRE(!mp.Erase(1));
+    REQUIRE(!mp.Contains(1));
+    REQUIRE(mp.Empty());
+
+    const int readers = 4, keys = 1'000, stable = 100, rounds = 200;
+    std::atomic<bool> done = false;
+    std::atomic<int> torn = 0, lost = 0;
+    for (int key = 0; key < stable; ++key) {
+        mp.Insert({key, {key, -key}});
+    }
+    std::vector<std::thread> threads;
+    for (int reader = 0; reader < readers; ++reader) {
+        threads.emplace_back([&, reader] {
+            std::mt19937 rnd(reader);
+            test_utils::Quote found;
+            while (!done) {
+                // Odd readers look up outside of sessions.
+                std::optional<SeqlockHashMap<int, test_utils::Quote>::ReadSession> session;
+                if (reader % 2 == 0) {
+                    session.emplace();
+                }
+                for (int lookup = 0; lookup < 256; ++lookup) {
+                    int key = rnd() % keys;
+                    if (mp.Find(key, found) && found.bid != -found.ask) {
+                        ++torn;
+                    }
+                    if (key < stable && !mp.Contains(key)) {
+                        ++lost;
+                    }
+                }
+            }
+        });
+    }
+    for (int round = 1; round <= rounds; ++round) {
+        for (int key = stable; key < keys; ++key) {
+            mp.Insert({key, {key * round, -key * round}});
+        }
+        for (int key = 0; key < keys; ++key) {
+            mp.Assign(key, {key + round, -key - round});
+        }
+        for (int key = stable; key < keys; ++key) {
+            mp.Erase(key);
+        }
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(torn == 0);
+    REQUIRE(lost == 0);
+    REQUIRE(mp.Size() == stable);
+    mp.ReleaseRetired();
+    REQUIRE(mp.Find(stable - 1, quote));
+    REQUIRE(quote.bid == stable - 1 + rounds);
+}
+
+TEST_CASE("Seqlock strided keys check") {
+    SeqlockHashMap<uint64_t, int> mp;
+    const int keys = 100'000;
+    for (int key = 0; key < keys; ++key) {
+        REQUIRE(mp.Insert({static_cast<uint64_t>(key) << 20, key}));
+    }
+    for (int key = 0; key < keys; key += 7) {
+        int value = -1;
+        REQUIRE(mp.Find(static_cast<uint64_t>(key) << 20, value));
+        REQUIRE(value == key);
+        REQUIRE(!mp.Contains((static_cast<uint64_t>(key) << 20) + 1));
+    }
+    REQUIRE(mp.Size() == keys);
+}
+
+TEST_CASE("Left-right map check") {
+    LeftRightHashMap<int, std::string> mp;
+    REQUIRE(mp.Insert({1, "one"}));
+    REQUIRE(!mp.Insert({1, "uno"}));
+    mp.Assign(2, "two");
+    std::string value;
+    REQUIRE(mp.Find(2, [&](const std::string& found) { value = found; }));
+    REQUIRE(value == "two");
+    REQUIRE(mp.Size() == 2);
+    REQUIRE(mp.Erase(1));
+    REQUIRE(!mp.Erase(1));
+    mp.Clear();
+    REQUIRE(mp.Empty());
+
+    const int readers = 4, keys = 2'000, stable = 100;
+    std::atomic<bool> done = false;
+    std::atomic<int> mismatches = 0, lost = 0;
+    for (int key = 0; key < stable; ++key) {
+        mp.Insert({key, std::to_string(key)});
+    }
+    std::vector<std::thread> threads;
+    for (int reader = 0; reader < readers; ++reader) {
+        threads.emplace_back([&, reader] {
+            std::mt19937 rnd(reader);
+            while (!done) {
+                int key = rnd() % keys;
+                bool found = mp.Find(key, [&](const std::string& found) {
+                    if (found != std::to_string(key)) {
+                        ++mismatches;
+                    }
+                });
+                if (key < stable && !found) {
+                    ++lost;
+                }
+            }
+        });
+    }
+    for (int key = stable; key < keys; ++key) {
+        mp.Insert({key, std::to_string(key)});
+        if (key % 2 == 0) {
+            mp.Erase(key);
+        }
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(mismatches == 0);
+    REQUIRE(lost == 0);
+    REQUIRE(mp.Size() == stable + (keys - stable) / 2);
+}
+
+namespace test_utils {
+// HashMap assigns values into its slots; this one throws once a global budget of assignments is
+// used up.
+struct AssignBudget {
+    static int assignments_left;
+
+    int x = 0;
+
+    AssignBudget() = default;
+    AssignBudget(int x) : x(x) {
+    }
+    AssignBudget(const AssignBudget&) = default;
+    AssignBudget& operator=(const AssignBudget& other) {
+        if (assignments_left >= 0 && assignments_left-- == 0) {
+            throw std::runtime_error("assignment budget exhausted");
+        }
+        x = other.x;
+        return *this;
+    }
+};
+
+int AssignBudget::assignments_left = -1;
+}  // namespace test_utils
+
+TEST_CASE("Left-right exception check") {
+    // Each budget lets the value be assigned a few more times before the write throws, first
+    // while the inactive copy is updated and later while the operation is replayed on the other.
+    LeftRightHashMap<int, test_utils::AssignBudget> mp;
+    bool replay_failed = false;
+    size_t size = 0;
+    for (int budget = 0; budget < 8; ++budget) {
+        test_utils::AssignBudget::assignments_left = budget;
+        bool threw = false;
+        try {
+            mp.Insert({budget, budget});
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        test_utils::AssignBudget::assignments_left = -1;
+        bool inserted = mp.Contains(budget);
+        replay_failed |= threw && inserted;
+        size += inserted;
+        // Every write switches readers to the other copy; both must agree.
+        for (int flip = 0; flip < 2; ++flip) {
+            REQUIRE(!mp.Erase(-1));
+            REQUIRE(mp.Contains(budget) == inserted);
+            REQUIRE(mp.Size() == size);
+        }
+    }
+    REQUIRE(replay_failed);
+}
+
 TEST_CASE("Stress test") {
     for (int test = 0; test < test_utils::kTests; test++) {
         std::vector<size_t> ind;
@@ -409,3 +1676,117 @@ TEST_CASE("Stress test") {
         }
     }
 }
+
+TEST_CASE("Hopscotch check") {
+    HopscotchHashMap<int, int> map{{1, 5}, {3, 4}, {2, 1}};
+    REQUIRE(map.Size() == 3);
+    REQUIRE(map.At(3) == 4);
+    REQUIRE(map.Find(7) == map.end());
+    map[7] = 8;
+    map.Erase(1);
+    REQUIRE(map.Find(1) == map.end());
+    REQUIRE(map.Find(7)->second == 8);
+
+    HopscotchHashMap<int, int> copy(map);
+    copy = copy = map;
+    HopscotchHashMap<int, int> moved(std::move(copy));
+    REQUIRE(moved.Size() == 3);
+    // Moved-from maps are empty and usable.
+    REQUIRE(copy.Empty());
+    REQUIRE(copy.begin() == copy.end());
+    copy[4] = 2;
+    REQUIRE(copy.At(4) == 2);
+    copy = std::move(moved);
+    REQUIRE(copy.Size() == 3);
+    REQUIRE(moved.Find(7) == moved.end());
+    moved[5] = 6;
+    REQUIRE(moved.Size() == 1);
+
+    auto strided_hash = [](int x) -> size_t { return static_cast<size_t>(x) * 1024; };
+    HopscotchHashMap<int, int, decltype(strided_hash)> strided(strided_hash);
+    for (int i = 0; i < 10'000; ++i) {
+        strided[i] = i;
+    }
+    for (int i = 0; i < 10'000; ++i) {
+        REQUIRE(strided.At(i) == i);
+    }
+
+    HopscotchHashMap<int, int, std::function<size_t(int)>> stupid_map(test_utils::StupidHash);
+    for (int i = 0; i < 32; ++i) {
+        stupid_map[i] = i;
+    }
+    REQUIRE_THROWS_AS(stupid_map[32], std::length_error);
+    REQUIRE(stupid_map.Size() == 32);
+
+    // Keys that differ only in high bits spread once the hash is finalized.
+    HopscotchHashMap<uint64_t, int> high_bits;
+    for (uint64_t i = 0; i < 1'000; ++i) {
+        high_bits[i << 40] = i;
+    }
+    REQUIRE(high_bits.At(999ULL << 40) == 999);
+
+    // Distinct hashes that still share their low bits after the finalizer cannot be separated by
+    // growing a mostly empty table.
+    auto low_bits_hash = [](uint64_t x) -> size_t { return test_utils::InverseFmix64(x << 40); };
+    HopscotchHashMap<uint64_t, int, decltype(low_bits_hash)> colliding(low_bits_hash);
+    for (uint64_t i = 0; i < 32; ++i) {
+        colliding[i] = i;
+    }
+    REQUIRE_THROWS_AS(colliding[32], std::length_error);
+    REQUIRE(colliding.Size() == 32);
+    REQUIRE(colliding.At(31) == 31);
+
+    // Two full neighborhoods that merge when the table shrinks overflow before most keys are
+    // back; the load that decides whether to grow again is that of all of them.
+    HopscotchHashMap<uint64_t, int, test_utils::IdentityAvalanchingHash> merging;
+    std::vector<uint64_t> fillers;
+    for (uint64_t i = 0; i < 240; ++i) {
+        fillers.push_back(i < 192 ? 320 + i : i - 128);
+        merging[fillers.back()] = 0;
+    }
+    for (uint64_t i = 1; i <= 32; ++i) {
+        merging[i * 1'024] = 1;
+        merging[i * 1'024 + 256] = 2;
+    }
+    // The 63 fillers left sit after both neighborhoods, so they are reinserted last.
+    for (size_t i = 63; i < fillers.size(); ++i) {
+        REQUIRE_NOTHROW(merging.Erase(fillers[i]));
+    }
+    REQUIRE(merging.Size() == 127);
+    for (uint64_t i = 1; i <= 32; ++i) {
+        REQUIRE(merging.At(i * 1'024) == 1);
+        REQUIRE(merging.At(i * 1'024 + 256) == 2);
+    }
+}
+
+TEST_CASE("Hopscotch stress test") {
+    std::unordered_map<int, int> a;
+    HopscotchHashMap<int, int> b;
+    for (int iter = 0; iter < 100'000; ++iter) {
+        int key = test_utils::Get(-1000, 1000), val = test_utils::Get(-100, 100);
+        switch (test_utils::Get(0, 3)) {
+            case 0:
+                a.insert({key, val});
+                b.Insert({key, val});
+                break;
+            case 1:
+                a[key] = val;
+                b[key] = val;
+                break;
+            case 2:
+                a.erase(key);
+                b.Erase(key);
+                break;
+            default:
+                REQUIRE((a.find(key) == a.end()) == (b.Find(key) == b.end()));
+        }
+        REQUIRE(a.size() == b.Size());
+    }
+    std::vector<std::pair<int, int>> x(a.begin(), a.end()), y;
+    for (auto [key, val] : b) {
+        y.push_back({key, val});
+    }
+    std::sort(x.begin(), x.end());
+    std::sort(y.begin(), y.end());
+    REQUIRE(x == y);
+}